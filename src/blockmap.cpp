@@ -38,12 +38,29 @@ static constexpr size_t LIST_ZERO = 1;
 static constexpr size_t LIST_END = 1;
 static constexpr size_t EXTRA_LINES = LIST_ZERO + LIST_END;
 
-static constexpr size_t m_zero = ZERO_INDEX;
-static constexpr size_t m_neg1 = NO_INDEX;
-
 static constexpr size_t HeaderIndexSize = 4;
 static constexpr size_t NullBlockIndexSize = 2;
 
+// every engine hardcodes the block size, only the origin can be moved
+static constexpr int32_t BLOCK_UNITS = 128;
+static constexpr int32_t ORIGIN_STEP = 8;
+static constexpr int32_t ORIGIN_TRIES = BLOCK_UNITS / ORIGIN_STEP;
+
+// the origin search only pays off near the vanilla limit: below this
+// the classic origin is kept, and above the upper bound no origin can
+// avoid the XBM1 format.  Both are in 16-bit words, like the limit.
+static constexpr size_t ORIGIN_SEARCH_MIN = LIMIT_BMAP_INDEX - LIMIT_BMAP_INDEX / 8;
+static constexpr size_t ORIGIN_SEARCH_MAX = LIMIT_BMAP_INDEX + LIMIT_BMAP_INDEX / 8;
+
+using blockmap_origin_t = struct blockmap_origin_s
+{
+  int32_t x, y;
+  size_t w, h;
+
+  size_t entries; // total number of block list entries
+  size_t size;    // lump size in indexes, after compression
+};
+
 /* ----- create blockmap ------------------------------------ */
 
 static void FindBlockmapLimits(level_t &level, bbox_t *bbox)
@@ -97,6 +114,206 @@ static void FindBlockmapLimits(level_t &level, bbox_t *bbox)
   }
 }
 
+// visit every block touched by the linedef, in a blockmap of the given
+// origin and size.
+template <typename F>
+static void BlockWalkLine(int32_t origin_x, int32_t origin_y, size_t w, size_t h, const linedef_t *L, const F &func)
+{
+  auto x1 = FloatToShort(L->start->x);
+  auto y1 = FloatToShort(L->start->y);
+  auto x2 = FloatToShort(L->end->x);
+  auto y2 = FloatToShort(L->end->y);
+
+  auto bx1_temp = (std::min(x1, x2) - origin_x) / BLOCK_UNITS;
+  auto by1_temp = (std::min(y1, y2) - origin_y) / BLOCK_UNITS;
+  auto bx2_temp = (std::max(x1, x2) - origin_x) / BLOCK_UNITS;
+  auto by2_temp = (std::max(y1, y2) - origin_y) / BLOCK_UNITS;
+
+  // handle truncated blockmaps
+  size_t bx1 = static_cast<size_t>(std::max(bx1_temp, 0));
+  size_t by1 = static_cast<size_t>(std::max(by1_temp, 0));
+  size_t bx2 = static_cast<size_t>(std::min(bx2_temp, static_cast<int32_t>(w - 1)));
+  size_t by2 = static_cast<size_t>(std::min(by2_temp, static_cast<int32_t>(h - 1)));
+
+  if (bx2 < bx1 || by2 < by1)
+  {
+    return;
+  }
+
+  // handle simple case #1: completely horizontal
+  if (by1 == by2)
+  {
+    for (size_t bx = bx1; bx <= bx2; bx++)
+    {
+      func(by1 * w + bx);
+    }
+    return;
+  }
+
+  // handle simple case #2: completely vertical
+  if (bx1 == bx2)
+  {
+    for (size_t by = by1; by <= by2; by++)
+    {
+      func(by * w + bx1);
+    }
+    return;
+  }
+
+  // handle the rest (diagonals)
+
+  for (size_t by = by1; by <= by2; by++)
+  {
+    for (size_t bx = bx1; bx <= bx2; bx++)
+    {
+      auto minx = origin_x + BLOCK_UNITS * static_cast<int32_t>(bx);
+      auto miny = origin_y + BLOCK_UNITS * static_cast<int32_t>(by);
+      auto maxx = minx + BLOCK_UNITS - 1;
+      auto maxy = miny + BLOCK_UNITS - 1;
+
+      if (CheckLinedefInsideBox(minx, miny, maxx, maxy, x1, y1, x2, y2))
+      {
+        func(bx + by * w);
+      }
+    }
+  }
+}
+
+// cheap counting pass: works out the size of the blockmap for a given
+// origin, without building any of the block lists.  duplicate blocks are
+// detected by their length and checksum alone, so this is an estimate.
+static void CountBlockmap(const level_t &level, blockmap_origin_t &origin)
+{
+  size_t block_count = origin.w * origin.h;
+
+  std::vector<size_t> counts(block_count, 0);
+  std::vector<uint64_t> hashes(block_count, 0x1234123412341234);
+
+  origin.entries = 0;
+
+  for (size_t i = 0; i < level.linedefs.size(); i++)
+  {
+    const linedef_t *L = level.linedefs[i];
+
+    if (HAS_BIT(L->effects, FX_NoBlockmap | FX_ZeroLength))
+    {
+      continue;
+    }
+
+    BlockWalkLine(origin.x, origin.y, origin.w, origin.h, L,
+                  [&](size_t blk_num)
+                  {
+                    hashes[blk_num] = std::rotl(hashes[blk_num], 4) ^ L->index;
+                    counts[blk_num]++;
+                  });
+  }
+
+  std::vector<std::pair<size_t, uint64_t>> blocks;
+  blocks.reserve(block_count);
+
+  for (size_t i = 0; i < block_count; i++)
+  {
+    if (counts[i] > 0)
+    {
+      blocks.emplace_back(counts[i], hashes[i]);
+      origin.entries += counts[i];
+    }
+  }
+
+  std::sort(blocks.begin(), blocks.end());
+  blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+
+  origin.size = block_count + HeaderIndexSize + NullBlockIndexSize;
+
+  for (const auto &blk : blocks)
+  {
+    origin.size += blk.first + EXTRA_LINES;
+  }
+}
+
+// -Elf- the origin decides how many lines straddle the block borders,
+//       so for maps close to the vanilla limit, try every 8-unit offset
+//       within one block and keep the one giving the smallest lump.
+//       ties keep the classic origin.
+static void OptimizeBlockmapOrigin(level_t &level, const bbox_t &map_bbox)
+{
+  auto mark = Benchmarker(__func__);
+
+  // XBM1 has no size limit, nothing to gain
+  if (std::max(level.bmap_format, config.bmap_format) >= BMAP_XBM1 || level.linedefs.size() > LIMIT_LINE)
+  {
+    return;
+  }
+
+  blockmap_origin_t classic{};
+  classic.x = level.block_x;
+  classic.y = level.block_y;
+  classic.w = level.block_w;
+  classic.h = level.block_h;
+
+  CountBlockmap(level, classic);
+
+  if (classic.size < ORIGIN_SEARCH_MIN || classic.size > ORIGIN_SEARCH_MAX)
+  {
+    if (HAS_BIT(config.debug, DEBUG_BLOCKMAP))
+    {
+      PrintLine(LOG_DEBUG, "[%s] Classic origin size %zu, not searching", __func__, classic.size);
+    }
+    return;
+  }
+
+  std::vector<blockmap_origin_t> origins;
+  origins.reserve(ORIGIN_TRIES * ORIGIN_TRIES);
+
+  for (int32_t dy = 0; dy < ORIGIN_TRIES; dy++)
+  {
+    for (int32_t dx = 0; dx < ORIGIN_TRIES; dx++)
+    {
+      // already counted
+      if (dx == 0 && dy == 0)
+      {
+        continue;
+      }
+
+      blockmap_origin_t origin{};
+      origin.x = level.block_x - dx * ORIGIN_STEP;
+      origin.y = level.block_y - dy * ORIGIN_STEP;
+
+      if (origin.x < SHRT_MIN || origin.y < SHRT_MIN)
+      {
+        continue;
+      }
+
+      origin.w = static_cast<size_t>((map_bbox.maxx - origin.x) / BLOCK_UNITS) + 1;
+      origin.h = static_cast<size_t>((map_bbox.maxy - origin.y) / BLOCK_UNITS) + 1;
+      origins.push_back(origin);
+    }
+  }
+
+  ParallelFor(origins.size(), [&](size_t i) { CountBlockmap(level, origins[i]); });
+
+  const blockmap_origin_t *best = &classic;
+
+  for (const auto &origin : origins)
+  {
+    if (origin.size < best->size || (origin.size == best->size && origin.entries < best->entries))
+    {
+      best = &origin;
+    }
+  }
+
+  if (HAS_BIT(config.debug, DEBUG_BLOCKMAP))
+  {
+    PrintLine(LOG_DEBUG, "[%s] Origin (%d,%d) size %zu entries %zu, classic origin size %zu entries %zu", __func__, best->x,
+              best->y, best->size, best->entries, classic.size, classic.entries);
+  }
+
+  level.block_x = static_cast<int16_t>(best->x);
+  level.block_y = static_cast<int16_t>(best->y);
+  level.block_w = best->w;
+  level.block_h = best->h;
+}
+
 void InitBlockmap(level_t &level)
 {
   bbox_t map_bbox;
@@ -112,8 +329,13 @@ void InitBlockmap(level_t &level)
   level.block_x = map_bbox.minx - (map_bbox.minx & 0x7);
   level.block_y = map_bbox.miny - (map_bbox.miny & 0x7);
 
-  level.block_w = static_cast<size_t>((map_bbox.maxx - level.block_x) / 128) + 1;
-  level.block_h = static_cast<size_t>((map_bbox.maxy - level.block_y) / 128) + 1;
+  level.block_w = static_cast<size_t>((map_bbox.maxx - level.block_x) / BLOCK_UNITS) + 1;
+  level.block_h = static_cast<size_t>((map_bbox.maxy - level.block_y) / BLOCK_UNITS) + 1;
+
+  if (level.linedefs.size() > 0)
+  {
+    OptimizeBlockmapOrigin(level, map_bbox);
+  }
 
   level.block_count = level.block_w * level.block_h;
 }
@@ -152,75 +374,14 @@ static void BlockAdd(level_t &level, size_t blk_num, size_t line_index)
 
 static void BlockAddLine(level_t &level, const linedef_t *L)
 {
-  auto x1 = FloatToShort(L->start->x);
-  auto y1 = FloatToShort(L->start->y);
-  auto x2 = FloatToShort(L->end->x);
-  auto y2 = FloatToShort(L->end->y);
-
-  size_t line_index = L->index;
-
   if (HAS_BIT(config.debug, DEBUG_BLOCKMAP))
   {
-    PrintLine(LOG_DEBUG, "[%s] %zu (%d,%d) -> (%d,%d)", __func__, line_index, x1, y1, x2, y2);
+    PrintLine(LOG_DEBUG, "[%s] %zu (%1.0f,%1.0f) -> (%1.0f,%1.0f)", __func__, L->index, L->start->x, L->start->y, L->end->x,
+              L->end->y);
   }
 
-  auto bx1_temp = (std::min(x1, x2) - level.block_x) / 128;
-  auto by1_temp = (std::min(y1, y2) - level.block_y) / 128;
-  auto bx2_temp = (std::max(x1, x2) - level.block_x) / 128;
-  auto by2_temp = (std::max(y1, y2) - level.block_y) / 128;
-
-  // handle truncated blockmaps
-  size_t bx1 = static_cast<size_t>(std::max(bx1_temp, 0));
-  size_t by1 = static_cast<size_t>(std::max(by1_temp, 0));
-  size_t bx2 = static_cast<size_t>(std::min(bx2_temp, static_cast<int32_t>(level.block_w - 1)));
-  size_t by2 = static_cast<size_t>(std::min(by2_temp, static_cast<int32_t>(level.block_h - 1)));
-
-  if (bx2 < bx1 || by2 < by1)
-  {
-    return;
-  }
-
-  // handle simple case #1: completely horizontal
-  if (by1 == by2)
-  {
-    for (size_t bx = bx1; bx <= bx2; bx++)
-    {
-      size_t blk_num = by1 * level.block_w + bx;
-      BlockAdd(level, blk_num, line_index);
-    }
-    return;
-  }
-
-  // handle simple case #2: completely vertical
-  if (bx1 == bx2)
-  {
-    for (size_t by = by1; by <= by2; by++)
-    {
-      size_t blk_num = by * level.block_w + bx1;
-      BlockAdd(level, blk_num, line_index);
-    }
-    return;
-  }
-
-  // handle the rest (diagonals)
-
-  for (size_t by = by1; by <= by2; by++)
-  {
-    for (size_t bx = bx1; bx <= bx2; bx++)
-    {
-      size_t blk_num = bx + by * level.block_w;
-
-      auto minx = level.block_x + 128 * static_cast<int32_t>(bx);
-      auto miny = level.block_y + 128 * static_cast<int32_t>(by);
-      auto maxx = minx + 127;
-      auto maxy = miny + 127;
-
-      if (CheckLinedefInsideBox(minx, miny, maxx, maxy, x1, y1, x2, y2))
-      {
-        BlockAdd(level, blk_num, line_index);
-      }
-    }
-  }
+  BlockWalkLine(level.block_x, level.block_y, level.block_w, level.block_h, L,
+                [&level, L](size_t blk_num) { BlockAdd(level, blk_num, L->index); });
 }
 
 // initial phase: create internal blockmap containing the index of
@@ -260,8 +421,8 @@ static void CompressBlockmap(level_t &level)
   size_t new_size = 0;
   size_t duplicate_count = 0;
 
-  level.block_indexes.reserve(level.block_count);
-  level.block_duplicates.reserve(level.block_count);
+  level.block_indexes.assign(level.block_count, 0);
+  level.block_duplicates.assign(level.block_count, 0);
 
   // sort duplicate-detecting array.  After the sort, all duplicates
   // will be next to each other.  The duplicate array gives the order
@@ -283,7 +444,8 @@ static void CompressBlockmap(level_t &level)
 
     return A.lines < B.lines ? -1 : 1;
   };
-  std::sort(level.block_duplicates.begin(), level.block_duplicates.end(), BlockCompare);
+  std::sort(level.block_duplicates.begin(), level.block_duplicates.end(),
+            [&BlockCompare](size_t blk_num1, size_t blk_num2) { return BlockCompare(blk_num1, blk_num2) < 0; });
 
   current_index = level.block_count + HeaderIndexSize + NullBlockIndexSize;
   original_size = level.block_count + HeaderIndexSize;
@@ -348,48 +510,13 @@ static void CompressBlockmap(level_t &level)
   level.block_compression = std::max(0.0, level.block_compression);
 }
 
-// compute size of final BLOCKMAP lump.
-static size_t CalcBlockmapSize(level_t &level, const char *Prefix, size_t PrefixSize, size_t NumSize, size_t RawHeaderSize)
-{
-  size_t size = PrefixSize;
-  size += RawHeaderSize;
-  size += EXTRA_LINES * NumSize;       // null block
-  size += level.block_count * NumSize; // the pointers (indexes to the line lists)
-
-  // add size of each block
-  for (size_t i = 0; i < level.block_count; i++)
-  {
-    size_t blk_num = level.block_duplicates[i];
-    if (blk_num == NO_INDEX) continue; // ignore duplicate or empty blocks
-    const auto &blk = level.block_lines[blk_num];
-    size += (blk.lines.size() + EXTRA_LINES) * NumSize;
-  }
-
-  if (HAS_BIT(config.debug, DEBUG_BLOCKMAP))
-  {
-    PrintLine(LOG_DEBUG, "[%s] Lump prefix header \'%s\', num type size of %zu, total size of %zu", __func__, Prefix, NumSize,
-              size);
-  }
-
-  return size;
-}
-
 template <bmap_format_t format, typename NumType>
 static void WriteBlockmap(level_t &level)
 {
-  constexpr size_t NumSize = sizeof(NumType);
-  size_t max_size = 0;
-
-  if constexpr (format == BMAP_XBM1)
-  {
-    max_size = CalcBlockmapSize(level, "XBM1", 8, NumSize, sizeof(raw_blockmap_xbm1_header_t));
-  }
-  else
-  {
-    max_size = CalcBlockmapSize(level, "", 0, NumSize, sizeof(raw_blockmap_header_t));
-  }
+  constexpr auto m_zero = static_cast<NumType>(ZERO_INDEX);
+  constexpr auto m_neg1 = static_cast<NumType>(NO_INDEX);
 
-  Lump_c *lump = CreateLevelLump(level, "BLOCKMAP", max_size);
+  Lump_c *lump = CreateLevelLump(level, "BLOCKMAP");
 
   if constexpr (format == BMAP_XBM1)
   {
@@ -415,17 +542,17 @@ static void WriteBlockmap(level_t &level)
   // handle pointers
   for (size_t i = 0; i < level.block_count; i++)
   {
-    NumType ptr = GetLittleEndian(static_cast<NumType>(level.block_indexes[i]));
+    auto ptr = static_cast<NumType>(level.block_indexes[i]);
     if (ptr == 0)
     {
       PrintLine(LOG_ERROR, "ERROR: WriteBlockmap: offset %zu not set.", i);
     }
-    lump->Write(&ptr, NumSize);
+    lump->Put(ptr);
   }
 
   // add the null block which *all* empty blocks will use
-  lump->Write(&m_zero, NumSize);
-  lump->Write(&m_neg1, NumSize);
+  lump->Put(m_zero);
+  lump->Put(m_neg1);
 
   // handle each block list
   for (size_t i = 0; i < level.block_count; i++)
@@ -437,13 +564,18 @@ static void WriteBlockmap(level_t &level)
 
     const auto &blk = level.block_lines[blk_num];
 
-    lump->Write(&m_zero, NumSize);
+    lump->Put(m_zero);
     for (size_t line : blk.lines)
     {
-      NumType le_line = GetLittleEndian(static_cast<NumType>(line));
-      lump->Write(&le_line, NumSize);
+      lump->Put(static_cast<NumType>(line));
     }
-    lump->Write(&m_neg1, NumSize);
+    lump->Put(m_neg1);
+  }
+
+  if (HAS_BIT(config.debug, DEBUG_BLOCKMAP))
+  {
+    PrintLine(LOG_DEBUG, "[%s] Lump prefix header \'%s\', num type size of %zu, total size of %zu", __func__,
+              format == BMAP_XBM1 ? "XBM1" : "", sizeof(NumType), lump->Written());
   }
 
   lump->Finish();
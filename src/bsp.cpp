@@ -21,7 +21,7 @@
 //
 //------------------------------------------------------------------------------
 
-#include <algorithm>
+#include <utility>
 
 #include "core.hpp"
 #include "local.hpp"
@@ -34,25 +34,49 @@ constexpr uint32_t NF_SUBSECTOR = UINT32_C(0x80000000);
 // Utility
 //
 
-struct Compare_seg_pred
+// rebuild the seg list from the subsectors, in the order given by
+// RenumberSegs(), and free every seg which is no longer in one (the
+// minisegs and degenerate segs taken out of the tree).
+static void CollectSegs(level_t &level)
 {
-  inline bool operator()(const seg_t *A, const seg_t *B) const
+  size_t count = 0;
+
+  for (const subsec_t *sub : level.subsecs)
   {
-    return A->index < B->index;
+    count += sub->seg_count;
   }
-};
 
-void SortSegs(level_t &level)
-{
-  // sort segs into ascending index
-  std::sort(level.segs.begin(), level.segs.end(), Compare_seg_pred());
+  std::vector<seg_t *> segs(count, nullptr);
 
-  // remove unwanted segs
-  while (level.segs.size() > 0 && level.segs.back()->index == SEG_IS_GARBAGE)
+  size_t cur_seg_index = 0;
+  for (const subsec_t *sub : level.subsecs)
   {
-    UtilFree(level.segs.back());
-    level.segs.pop_back();
+    for (seg_t *seg = sub->seg_list; seg; seg = seg->next, cur_seg_index++)
+    {
+      if (seg->index != cur_seg_index || cur_seg_index >= count)
+      {
+        PrintLine(LOG_ERROR, "ERROR: CollectSegs: seg index mismatch in sub %zu (%zu != %zu)", sub->index, seg->index,
+                  cur_seg_index);
+      }
+
+      segs[cur_seg_index] = seg;
+    }
+  }
+
+  if (cur_seg_index != count)
+  {
+    PrintLine(LOG_ERROR, "ERROR: CollectSegs miscounted (%zu != %zu)", cur_seg_index, count);
+  }
+
+  for (seg_t *seg : level.segs)
+  {
+    if (seg->index >= count || segs[seg->index] != seg)
+    {
+      UtilFree(seg);
+    }
   }
+
+  level.segs = std::move(segs);
 }
 
 static inline int16_t VanillaSegDist(const seg_t *seg)
@@ -101,9 +125,7 @@ static inline short_angle_t VanillaSegAngle(const seg_t *seg)
 
 static void PutVertices_Doom(level_t &level)
 {
-  // this size is worst-case scenario
-  size_t size = level.vertices.size() * sizeof(raw_vertex_t);
-  Lump_c *lump = CreateLevelLump(level, "VERTEXES", size);
+  Lump_c *lump = CreateLevelLump(level, "VERTEXES");
 
   size_t count = 0;
   for (size_t i = 0; i < level.vertices.size(); i++)
@@ -136,9 +158,7 @@ static void PutVertices_Doom(level_t &level)
 
 static void PutVertices_Doom64(level_t &level)
 {
-  // this size is worst-case scenario
-  size_t size = level.vertices.size() * sizeof(raw_vertex_doom64_t);
-  Lump_c *lump = CreateLevelLump(level, "VERTEXES", size);
+  Lump_c *lump = CreateLevelLump(level, "VERTEXES");
 
   for (size_t i = 0; i < level.vertices.size(); i++)
   {
@@ -158,16 +178,151 @@ static void PutVertices_Doom64(level_t &level)
   lump->Finish();
 }
 
+//
+// Nodes, shared by all formats
+//
+
+// number the nodes of the tree in post-order (right subtree, left
+// subtree, then the node itself), which is the order they are written
+// in.  This uses an explicit stack, as degenerate trees can be deep
+// enough to overflow the call stack.
+static void NumberNodes(node_t *root, std::vector<node_t *> &order)
+{
+  order.clear();
+
+  if (root == nullptr)
+  {
+    return;
+  }
+
+  // the second value tells whether the children were pushed already
+  std::vector<std::pair<node_t *, bool>> stack;
+  stack.emplace_back(root, false);
+
+  while (!stack.empty())
+  {
+    auto &[node, expanded] = stack.back();
+
+    if (expanded)
+    {
+      node->index = order.size();
+      order.push_back(node);
+      stack.pop_back();
+      continue;
+    }
+
+    expanded = true;
+
+    // pushed in reverse, so the right child is handled first
+    node_t *right = node->r.node;
+    node_t *left = node->l.node;
+
+    if (left)
+    {
+      stack.emplace_back(left, false);
+    }
+
+    if (right)
+    {
+      stack.emplace_back(right, false);
+    }
+  }
+}
+
+// raw value of a node child, in the byte order of the lump
+template <bsp_format_t format>
+static auto RawNodeChild(const child_t &child, const node_t *node, const char *which)
+{
+  if (!child.node && !child.subsec)
+  {
+    PrintLine(LOG_ERROR, "ERROR: Bad %s child in node %zu", which, node->index);
+  }
+
+  if constexpr (format == BSP_DoomBSP)
+  {
+    if (child.node)
+    {
+      return GetLittleEndian(IndexToShort(child.node->index));
+    }
+
+    return GetLittleEndian(IndexToShort(child.subsec->index | NF_SUBSECTOR_VANILLA));
+  }
+  else
+  {
+    if (child.node)
+    {
+      return GetLittleEndian(IndexToInt(child.node->index));
+    }
+
+    return GetLittleEndian(IndexToInt(child.subsec->index | NF_SUBSECTOR));
+  }
+}
+
+// write every node of the tree as a RawType record.
+// DoomBSP uses 16-bit children, all the others use 32-bit ones, and
+// only XGL3 has fractional partition lines.
+template <bsp_format_t format, typename RawType>
+static void PutNodeRecords(level_t &level, Lump_c *lump, node_t *root)
+{
+  std::vector<node_t *> order;
+  NumberNodes(root, order);
+
+  if (order.size() != level.nodes.size())
+  {
+    PrintLine(LOG_ERROR, "ERROR: PutNodes miscounted (%zu != %zu)", order.size(), level.nodes.size());
+  }
+
+  for (const node_t *node : order)
+  {
+    RawType raw;
+
+    if constexpr (format == BSP_XGL3)
+    {
+      raw.x = GetLittleEndian(FloatToFixed(node->x));
+      raw.y = GetLittleEndian(FloatToFixed(node->y));
+      raw.dx = GetLittleEndian(FloatToFixed(node->dx));
+      raw.dy = GetLittleEndian(FloatToFixed(node->dy));
+    }
+    else
+    {
+      raw.x = GetLittleEndian(FloatToShort(node->x));
+      raw.y = GetLittleEndian(FloatToShort(node->y));
+      raw.dx = GetLittleEndian(FloatToShort(node->dx));
+      raw.dy = GetLittleEndian(FloatToShort(node->dy));
+    }
+
+    raw.b1.minx = GetLittleEndian(node->r.bounds.minx);
+    raw.b1.miny = GetLittleEndian(node->r.bounds.miny);
+    raw.b1.maxx = GetLittleEndian(node->r.bounds.maxx);
+    raw.b1.maxy = GetLittleEndian(node->r.bounds.maxy);
+
+    raw.b2.minx = GetLittleEndian(node->l.bounds.minx);
+    raw.b2.miny = GetLittleEndian(node->l.bounds.miny);
+    raw.b2.maxx = GetLittleEndian(node->l.bounds.maxx);
+    raw.b2.maxy = GetLittleEndian(node->l.bounds.maxy);
+
+    raw.right = RawNodeChild<format>(node->r, node, "right");
+    raw.left = RawNodeChild<format>(node->l, node, "left");
+
+    lump->Write(&raw, sizeof(RawType));
+
+    if (HAS_BIT(config.debug, DEBUG_BSP))
+    {
+      PrintLine(LOG_DEBUG, "[%s] %zu  Left %0*X  Right %0*X  (%1.1f,%1.1f) -> (%1.1f,%1.1f)", __func__, node->index,
+                static_cast<int32_t>(sizeof(raw.left) * 2), GetLittleEndian(raw.left),
+                static_cast<int32_t>(sizeof(raw.right) * 2), GetLittleEndian(raw.right), node->x, node->y, node->x + node->dx,
+                node->y + node->dy);
+    }
+  }
+}
+
 //
 // Vanilla format
 //
 
 static void PutSegs_Vanilla(level_t &level)
 {
-  // this size is worst-case scenario
-  size_t size = level.segs.size() * sizeof(raw_seg_vanilla_t);
-
-  Lump_c *lump = CreateLevelLump(level, "SEGS", size);
+  Lump_c *lump = CreateLevelLump(level, "SEGS");
 
   for (size_t i = 0; i < level.segs.size(); i++)
   {
@@ -197,9 +352,7 @@ static void PutSegs_Vanilla(level_t &level)
 
 static void PutSubsecs_Vanilla(level_t &level)
 {
-  size_t size = level.subsecs.size() * sizeof(raw_subsec_vanilla_t);
-
-  Lump_c *lump = CreateLevelLump(level, "SSECTORS", size);
+  Lump_c *lump = CreateLevelLump(level, "SSECTORS");
 
   for (size_t i = 0; i < level.subsecs.size(); i++)
   {
@@ -222,90 +375,11 @@ static void PutSubsecs_Vanilla(level_t &level)
   lump->Finish();
 }
 
-static void PutOneNode_Vanilla(Lump_c *lump, node_t *node, size_t &node_cur_index)
-{
-  if (node->r.node)
-  {
-    PutOneNode_Vanilla(lump, node->r.node, node_cur_index);
-  }
-
-  if (node->l.node)
-  {
-    PutOneNode_Vanilla(lump, node->l.node, node_cur_index);
-  }
-
-  node->index = node_cur_index++;
-
-  raw_node_vanilla_t raw;
-
-  raw.x = GetLittleEndian(FloatToShort(node->x));
-  raw.y = GetLittleEndian(FloatToShort(node->y));
-  raw.dx = GetLittleEndian(FloatToShort(node->dx));
-  raw.dy = GetLittleEndian(FloatToShort(node->dy));
-
-  raw.b1.minx = GetLittleEndian(node->r.bounds.minx);
-  raw.b1.miny = GetLittleEndian(node->r.bounds.miny);
-  raw.b1.maxx = GetLittleEndian(node->r.bounds.maxx);
-  raw.b1.maxy = GetLittleEndian(node->r.bounds.maxy);
-
-  raw.b2.minx = GetLittleEndian(node->l.bounds.minx);
-  raw.b2.miny = GetLittleEndian(node->l.bounds.miny);
-  raw.b2.maxx = GetLittleEndian(node->l.bounds.maxx);
-  raw.b2.maxy = GetLittleEndian(node->l.bounds.maxy);
-
-  if (node->r.node)
-  {
-    raw.right = GetLittleEndian(IndexToShort(node->r.node->index));
-  }
-  else if (node->r.subsec)
-  {
-    raw.right = GetLittleEndian(IndexToShort(node->r.subsec->index | NF_SUBSECTOR_VANILLA));
-  }
-  else
-  {
-    PrintLine(LOG_ERROR, "ERROR: Bad right child in node %zu", node->index);
-  }
-
-  if (node->l.node)
-  {
-    raw.left = GetLittleEndian(IndexToShort(node->l.node->index));
-  }
-  else if (node->l.subsec)
-  {
-    raw.left = GetLittleEndian(IndexToShort(node->l.subsec->index | NF_SUBSECTOR_VANILLA));
-  }
-  else
-  {
-    PrintLine(LOG_ERROR, "ERROR: Bad left child in node %zu", node->index);
-  }
-
-  lump->Write(&raw, sizeof(raw_node_vanilla_t));
-
-  if (HAS_BIT(config.debug, DEBUG_BSP))
-  {
-    PrintLine(LOG_DEBUG, "[%s] %zu  Left %04X  Right %04X  (%1.1f,%1.1f) -> (%1.1f,%1.1f)", __func__, node->index,
-              GetLittleEndian(raw.left), GetLittleEndian(raw.right), node->x, node->y, node->x + node->dx, node->y + node->dy);
-  }
-}
-
 static void PutNodes_Vanilla(level_t &level, node_t *root_node)
 {
-  // this can be bigger than the actual size, but never smaller
-  size_t max_size = (level.nodes.size() + 1) * sizeof(raw_node_vanilla_t);
-  size_t node_cur_index = 0;
-  Lump_c *lump = CreateLevelLump(level, "NODES", max_size);
-
-  if (root_node != nullptr)
-  {
-    PutOneNode_Vanilla(lump, root_node, node_cur_index);
-  }
-
+  Lump_c *lump = CreateLevelLump(level, "NODES");
+  PutNodeRecords<BSP_DoomBSP, raw_node_vanilla_t>(level, lump, root_node);
   lump->Finish();
-
-  if (node_cur_index != level.nodes.size())
-  {
-    PrintLine(LOG_ERROR, "ERROR: PutNodes miscounted (%zu != %zu)", node_cur_index, level.nodes.size());
-  }
 }
 
 static void PutLeafs_Vanilla(level_t &level)
@@ -319,7 +393,7 @@ static void PutLeafs_Vanilla(level_t &level)
     seg_t *seg = subsec->seg_list;
     size_t seg_count = subsec->seg_count;
 
-    lump->Write(&seg_count, sizeof(uint16_t));
+    lump->Put(IndexToShort(seg_count));
 
     if (HAS_BIT(config.debug, DEBUG_BSP))
     {
@@ -359,6 +433,8 @@ static void PutLeafs_Vanilla(level_t &level)
       }
     }
   }
+
+  lump->Finish();
 }
 
 //
@@ -367,9 +443,7 @@ static void PutLeafs_Vanilla(level_t &level)
 
 static void PutSegs_DeePBSPV4(level_t &level)
 {
-  // this size is worst-case scenario
-  size_t size = level.segs.size() * sizeof(raw_seg_deepbspv4_t);
-  Lump_c *lump = CreateLevelLump(level, "SEGS", size);
+  Lump_c *lump = CreateLevelLump(level, "SEGS");
 
   for (size_t i = 0; i < level.segs.size(); i++)
   {
@@ -399,9 +473,7 @@ static void PutSegs_DeePBSPV4(level_t &level)
 
 static void PutSubsecs_DeePBSPV4(level_t &level)
 {
-  size_t size = level.subsecs.size() * sizeof(raw_subsec_deepbspv4_t);
-
-  Lump_c *lump = CreateLevelLump(level, "SSECTORS", size);
+  Lump_c *lump = CreateLevelLump(level, "SSECTORS");
 
   for (size_t i = 0; i < level.subsecs.size(); i++)
   {
@@ -424,93 +496,12 @@ static void PutSubsecs_DeePBSPV4(level_t &level)
   lump->Finish();
 }
 
-static void PutOneNode_DeePBSPV4(Lump_c *lump, node_t *node, size_t &node_cur_index)
-{
-  if (node->r.node)
-  {
-    PutOneNode_DeePBSPV4(lump, node->r.node, node_cur_index);
-  }
-
-  if (node->l.node)
-  {
-    PutOneNode_DeePBSPV4(lump, node->l.node, node_cur_index);
-  }
-
-  node->index = node_cur_index++;
-
-  raw_node_deepbspv4_t raw;
-
-  raw.x = GetLittleEndian(FloatToShort(node->x));
-  raw.y = GetLittleEndian(FloatToShort(node->y));
-  raw.dx = GetLittleEndian(FloatToShort(node->dx));
-  raw.dy = GetLittleEndian(FloatToShort(node->dy));
-
-  raw.b1.minx = GetLittleEndian(node->r.bounds.minx);
-  raw.b1.miny = GetLittleEndian(node->r.bounds.miny);
-  raw.b1.maxx = GetLittleEndian(node->r.bounds.maxx);
-  raw.b1.maxy = GetLittleEndian(node->r.bounds.maxy);
-
-  raw.b2.minx = GetLittleEndian(node->l.bounds.minx);
-  raw.b2.miny = GetLittleEndian(node->l.bounds.miny);
-  raw.b2.maxx = GetLittleEndian(node->l.bounds.maxx);
-  raw.b2.maxy = GetLittleEndian(node->l.bounds.maxy);
-
-  if (node->r.node)
-  {
-    raw.right = GetLittleEndian(IndexToInt(node->r.node->index));
-  }
-  else if (node->r.subsec)
-  {
-    raw.right = GetLittleEndian(IndexToInt(node->r.subsec->index | NF_SUBSECTOR));
-  }
-  else
-  {
-    PrintLine(LOG_ERROR, "ERROR: Bad right child in node %zu", node->index);
-  }
-
-  if (node->l.node)
-  {
-    raw.left = GetLittleEndian(IndexToInt(node->l.node->index));
-  }
-  else if (node->l.subsec)
-  {
-    raw.left = GetLittleEndian(IndexToInt(node->l.subsec->index | NF_SUBSECTOR));
-  }
-  else
-  {
-    PrintLine(LOG_ERROR, "ERROR: Bad left child in node %zu", node->index);
-  }
-
-  lump->Write(&raw, sizeof(raw_node_deepbspv4_t));
-
-  if (HAS_BIT(config.debug, DEBUG_BSP))
-  {
-    PrintLine(LOG_DEBUG, "[%s] %zu  Left %08X  Right %08X  (%1.1f,%1.1f) -> (%1.1f,%1.1f)", __func__, node->index,
-              GetLittleEndian(raw.left), GetLittleEndian(raw.right), node->x, node->y, node->x + node->dx, node->y + node->dy);
-  }
-}
-
 static void PutNodes_DeePBSPV4(level_t &level, node_t *root_node)
 {
-  // this can be bigger than the actual size, but never smaller
-  // 8 bytes for BSP_MAGIC_DEEPBSPV4 header
-  // size_t max_size = 8 + (level.nodes.size() + 1) * sizeof(raw_node_deepbspv4_t);
-  size_t node_cur_index = 0;
-
   Lump_c *lump = CreateLevelLump(level, "NODES");
   lump->Write("xNd4\0\0\0\0", 8);
-
-  if (root_node != nullptr)
-  {
-    PutOneNode_DeePBSPV4(lump, root_node, node_cur_index);
-  }
-
+  PutNodeRecords<BSP_DeePBSPV4, raw_node_deepbspv4_t>(level, lump, root_node);
   lump->Finish();
-
-  if (node_cur_index != level.nodes.size())
-  {
-    PrintLine(LOG_ERROR, "ERROR: PutNodes miscounted (%zu != %zu)", node_cur_index, level.nodes.size());
-  }
 }
 
 static void PutLeafs_DeePBSPV4(level_t &level)
@@ -524,7 +515,7 @@ static void PutLeafs_DeePBSPV4(level_t &level)
     seg_t *seg = subsec->seg_list;
     size_t seg_count = subsec->seg_count;
 
-    lump->Write(&seg_count, sizeof(uint32_t));
+    lump->Put(IndexToInt(seg_count));
 
     if (HAS_BIT(config.debug, DEBUG_BSP))
     {
@@ -564,6 +555,8 @@ static void PutLeafs_DeePBSPV4(level_t &level)
       }
     }
   }
+
+  lump->Finish();
 }
 
 //
@@ -582,11 +575,8 @@ static inline uint32_t VertexIndex_XNOD(level_t &level, const vertex_t *v)
 
 static void PutVertices_Xnod(level_t &level, Lump_c *lump)
 {
-  size_t orgverts = GetLittleEndian(level.num_old_vert);
-  size_t newverts = GetLittleEndian(level.num_new_vert);
-
-  lump->WriteZ(&orgverts, 4);
-  lump->WriteZ(&newverts, 4);
+  lump->Put(IndexToInt(level.num_old_vert));
+  lump->Put(IndexToInt(level.num_new_vert));
 
   size_t count = 0;
   for (size_t i = 0; i < level.vertices.size(); i++)
@@ -603,7 +593,7 @@ static void PutVertices_Xnod(level_t &level, Lump_c *lump)
     raw.x = GetLittleEndian(FloatToFixed(vert->x));
     raw.y = GetLittleEndian(FloatToFixed(vert->y));
 
-    lump->WriteZ(&raw, sizeof(raw_vertex_xnod_t));
+    lump->Write(&raw, sizeof(raw_vertex_xnod_t));
 
     count++;
   }
@@ -616,16 +606,14 @@ static void PutVertices_Xnod(level_t &level, Lump_c *lump)
 
 static void PutSubsecs_Xnod(level_t &level, Lump_c *lump)
 {
-  size_t raw_num = GetLittleEndian(level.subsecs.size());
-  lump->WriteZ(&raw_num, 4);
+  lump->Put(IndexToInt(level.subsecs.size()));
 
   size_t cur_seg_index = 0;
   for (size_t i = 0; i < level.subsecs.size(); i++)
   {
     const subsec_t *sub = level.subsecs[i];
 
-    raw_num = GetLittleEndian(sub->seg_count);
-    lump->WriteZ(&raw_num, 4);
+    lump->Put(IndexToInt(sub->seg_count));
 
     // sanity check the seg index values
     size_t count = 0;
@@ -653,8 +641,7 @@ static void PutSubsecs_Xnod(level_t &level, Lump_c *lump)
 
 static void PutSegs_Xnod(level_t &level, Lump_c *lump)
 {
-  size_t raw_num = GetLittleEndian(level.segs.size());
-  lump->WriteZ(&raw_num, 4);
+  lump->Put(IndexToInt(level.segs.size()));
 
   for (size_t i = 0; i < level.segs.size(); i++)
   {
@@ -671,107 +658,14 @@ static void PutSegs_Xnod(level_t &level, Lump_c *lump)
     raw.end = GetLittleEndian(VertexIndex_XNOD(level, seg->end));
     raw.linedef = GetLittleEndian(IndexToShort(seg->linedef->index));
     raw.side = seg->side;
-    lump->WriteZ(&raw, sizeof(raw_seg_xnod_t));
-  }
-}
-
-static void PutOneNode_Xnod(Lump_c *lump, node_t *node, size_t &node_cur_index)
-{
-  raw_node_xnod_t raw;
-
-  if (node->r.node)
-  {
-    PutOneNode_Xnod(lump, node->r.node, node_cur_index);
-  }
-
-  if (node->l.node)
-  {
-    PutOneNode_Xnod(lump, node->l.node, node_cur_index);
-  }
-
-  node->index = node_cur_index++;
-
-  raw.x = GetLittleEndian(FloatToShort(node->x));
-  raw.y = GetLittleEndian(FloatToShort(node->y));
-  raw.dx = GetLittleEndian(FloatToShort(node->dx));
-  raw.dy = GetLittleEndian(FloatToShort(node->dy));
-
-  raw.b1.minx = GetLittleEndian(node->r.bounds.minx);
-  raw.b1.miny = GetLittleEndian(node->r.bounds.miny);
-  raw.b1.maxx = GetLittleEndian(node->r.bounds.maxx);
-  raw.b1.maxy = GetLittleEndian(node->r.bounds.maxy);
-
-  raw.b2.minx = GetLittleEndian(node->l.bounds.minx);
-  raw.b2.miny = GetLittleEndian(node->l.bounds.miny);
-  raw.b2.maxx = GetLittleEndian(node->l.bounds.maxx);
-  raw.b2.maxy = GetLittleEndian(node->l.bounds.maxy);
-
-  if (node->r.node)
-  {
-    raw.right = GetLittleEndian(IndexToInt(node->r.node->index));
-  }
-  else if (node->r.subsec)
-  {
-    raw.right = GetLittleEndian(IndexToInt(node->r.subsec->index | NF_SUBSECTOR));
-  }
-  else
-  {
-    PrintLine(LOG_ERROR, "ERROR: Bad right child in ZDoom node %zu", node->index);
-  }
-
-  if (node->l.node)
-  {
-    raw.left = GetLittleEndian(IndexToInt(node->l.node->index));
-  }
-  else if (node->l.subsec)
-  {
-    raw.left = GetLittleEndian(IndexToInt(node->l.subsec->index | NF_SUBSECTOR));
-  }
-  else
-  {
-    PrintLine(LOG_ERROR, "ERROR: Bad left child in ZDoom node %zu", node->index);
-  }
-
-  lump->WriteZ(&raw, sizeof(raw_node_xnod_t));
-
-  if (HAS_BIT(config.debug, DEBUG_BSP))
-  {
-    PrintLine(LOG_DEBUG, "[%s] %zu  Left %08X  Right %08X  (%f,%f) -> (%f,%f)", __func__, node->index,
-              GetLittleEndian(raw.left), GetLittleEndian(raw.right), node->x, node->y, node->x + node->dx, node->y + node->dy);
+    lump->Write(&raw, sizeof(raw_seg_xnod_t));
   }
 }
 
 static void PutNodes_Xnod(level_t &level, Lump_c *lump, node_t *root)
 {
-  size_t node_cur_index = 0;
-  size_t raw_num = GetLittleEndian(level.nodes.size());
-  lump->WriteZ(&raw_num, 4);
-
-  if (root)
-  {
-    PutOneNode_Xnod(lump, root, node_cur_index);
-  }
-
-  if (node_cur_index != level.nodes.size())
-  {
-    PrintLine(LOG_ERROR, "ERROR: PutZNodes miscounted (%zu != %zu)", node_cur_index, level.nodes.size());
-  }
-}
-
-static size_t CalcXnodNodesSize(level_t &level)
-{
-  // compute size of the ZDoom format nodes.
-  // it does not need to be exact, but it *does* need to be bigger
-  // (or equal) to the actual size of the lump.
-
-  size_t size = 32; // header + a bit extra
-
-  size += 8 + level.vertices.size() * sizeof(raw_vertex_xnod_t);
-  size += 4 + level.subsecs.size() * sizeof(raw_subsec_xnod_t);
-  size += 4 + level.segs.size() * sizeof(raw_seg_xgl2_t);
-  size += 4 + level.nodes.size() * sizeof(raw_node_xgl3_t);
-
-  return size;
+  lump->Put(IndexToInt(level.nodes.size()));
+  PutNodeRecords<BSP_XNOD, raw_node_xnod_t>(level, lump, root);
 }
 
 //
@@ -780,8 +674,7 @@ static size_t CalcXnodNodesSize(level_t &level)
 
 static void PutSegs_Xgln(level_t &level, Lump_c *lump)
 {
-  size_t raw_num = GetLittleEndian(level.segs.size());
-  lump->WriteZ(&raw_num, 4);
+  lump->Put(IndexToInt(level.segs.size()));
 
   for (size_t i = 0; i < level.segs.size(); i++)
   {
@@ -799,7 +692,7 @@ static void PutSegs_Xgln(level_t &level, Lump_c *lump)
     raw.linedef = GetLittleEndian(IndexToShort(seg->linedef ? seg->linedef->index : NO_INDEX));
     raw.side = seg->side;
 
-    lump->WriteZ(&raw, sizeof(raw_seg_xgln_t));
+    lump->Write(&raw, sizeof(raw_seg_xgln_t));
 
     if (HAS_BIT(config.debug, DEBUG_BSP))
     {
@@ -811,8 +704,7 @@ static void PutSegs_Xgln(level_t &level, Lump_c *lump)
 
 static void PutSegs_Xgl2(level_t &level, Lump_c *lump)
 {
-  size_t raw_num = GetLittleEndian(level.segs.size());
-  lump->WriteZ(&raw_num, 4);
+  lump->Put(IndexToInt(level.segs.size()));
 
   for (size_t i = 0; i < level.segs.size(); i++)
   {
@@ -830,7 +722,7 @@ static void PutSegs_Xgl2(level_t &level, Lump_c *lump)
     raw.linedef = GetLittleEndian(IndexToInt(seg->linedef ? seg->linedef->index : NO_INDEX));
     raw.side = seg->side;
 
-    lump->WriteZ(&raw, sizeof(raw_seg_xgl2_t));
+    lump->Write(&raw, sizeof(raw_seg_xgl2_t));
 
     if (HAS_BIT(config.debug, DEBUG_BSP))
     {
@@ -840,87 +732,10 @@ static void PutSegs_Xgl2(level_t &level, Lump_c *lump)
   }
 }
 
-static void PutOneNode_Xgl3(Lump_c *lump, node_t *node, size_t &node_cur_index)
-{
-  raw_node_xgl3_t raw;
-
-  if (node->r.node)
-  {
-    PutOneNode_Xgl3(lump, node->r.node, node_cur_index);
-  }
-
-  if (node->l.node)
-  {
-    PutOneNode_Xgl3(lump, node->l.node, node_cur_index);
-  }
-
-  node->index = node_cur_index++;
-
-  raw.x = GetLittleEndian(FloatToFixed(node->x));
-  raw.y = GetLittleEndian(FloatToFixed(node->y));
-  raw.dx = GetLittleEndian(FloatToFixed(node->dx));
-  raw.dy = GetLittleEndian(FloatToFixed(node->dy));
-
-  raw.b1.minx = GetLittleEndian(node->r.bounds.minx);
-  raw.b1.miny = GetLittleEndian(node->r.bounds.miny);
-  raw.b1.maxx = GetLittleEndian(node->r.bounds.maxx);
-  raw.b1.maxy = GetLittleEndian(node->r.bounds.maxy);
-
-  raw.b2.minx = GetLittleEndian(node->l.bounds.minx);
-  raw.b2.miny = GetLittleEndian(node->l.bounds.miny);
-  raw.b2.maxx = GetLittleEndian(node->l.bounds.maxx);
-  raw.b2.maxy = GetLittleEndian(node->l.bounds.maxy);
-
-  if (node->r.node)
-  {
-    raw.right = GetLittleEndian(IndexToInt(node->r.node->index));
-  }
-  else if (node->r.subsec)
-  {
-    raw.right = GetLittleEndian(IndexToInt(node->r.subsec->index | NF_SUBSECTOR));
-  }
-  else
-  {
-    PrintLine(LOG_ERROR, "ERROR: Bad right child in ZDoom node %zu", node->index);
-  }
-
-  if (node->l.node)
-  {
-    raw.left = GetLittleEndian(IndexToInt(node->l.node->index));
-  }
-  else if (node->l.subsec)
-  {
-    raw.left = GetLittleEndian(IndexToInt(node->l.subsec->index | NF_SUBSECTOR));
-  }
-  else
-  {
-    PrintLine(LOG_ERROR, "ERROR: Bad left child in ZDoom node %zu", node->index);
-  }
-
-  lump->WriteZ(&raw, sizeof(raw_node_xgl3_t));
-
-  if (HAS_BIT(config.debug, DEBUG_BSP))
-  {
-    PrintLine(LOG_DEBUG, "[%s] %zu  Left %08X  Right %08X  (%f,%f) -> (%f,%f)", __func__, node->index,
-              GetLittleEndian(raw.left), GetLittleEndian(raw.right), node->x, node->y, node->x + node->dx, node->y + node->dy);
-  }
-}
-
 static void PutNodes_Xgl3(level_t &level, Lump_c *lump, node_t *root)
 {
-  size_t node_cur_index = 0;
-  size_t raw_num = GetLittleEndian(level.nodes.size());
-  lump->WriteZ(&raw_num, 4);
-
-  if (root)
-  {
-    PutOneNode_Xgl3(lump, root, node_cur_index);
-  }
-
-  if (node_cur_index != level.nodes.size())
-  {
-    PrintLine(LOG_ERROR, "ERROR: PutZNodes miscounted (%zu != %zu)", node_cur_index, level.nodes.size());
-  }
+  lump->Put(IndexToInt(level.nodes.size()));
+  PutNodeRecords<BSP_XGL3, raw_node_xgl3_t>(level, lump, root);
 }
 
 //
@@ -936,7 +751,7 @@ void SaveDoom_DoomBSP(level_t &level, node_t *root_node)
   // some segs can become "degenerate" after this, and these
   // are removed from subsectors.
   RoundOffBspTree(level);
-  SortSegs(level);
+  CollectSegs(level);
   PutVertices_Doom(level);
   PutSegs_Vanilla(level);
   PutSubsecs_Vanilla(level);
@@ -952,7 +767,7 @@ void SaveDoom_DeePBSPV4(level_t &level, node_t *root_node)
   // some segs can become "degenerate" after this, and these
   // are removed from subsectors.
   RoundOffBspTree(level);
-  SortSegs(level);
+  CollectSegs(level);
   PutVertices_Doom(level);
   PutSegs_DeePBSPV4(level);
   PutSubsecs_DeePBSPV4(level);
@@ -966,13 +781,14 @@ void SaveDoom_XNOD(level_t &level, node_t *root_node)
   CreateLevelLump(level, "SSECTORS")->Finish();
   // remove all the minisegs from subsectors
   NormaliseBspTree(level);
-  SortSegs(level);
+  CollectSegs(level);
+
+  Lump_c *lump = CreateLevelLump(level, "NODES");
 
-  Lump_c *lump = CreateLevelLump(level, "NODES", CalcXnodNodesSize(level));
+  lump->Write(level.bsp_compress ? "ZNOD" : "XNOD", 4);
 
   if (level.bsp_compress) lump->Begin_Zlib();
 
-  lump->Write(level.bsp_compress ? "ZNOD" : "XNOD", 4);
   PutVertices_Xnod(level, lump);
   PutSubsecs_Xnod(level, lump);
   PutSegs_Xnod(level, lump);
@@ -990,13 +806,14 @@ void SaveDoom_XGLN(level_t &level, node_t *root_node)
   // leave SEGS empty
   CreateLevelLump(level, "SEGS")->Finish();
 
-  SortSegs(level);
+  CollectSegs(level);
+
+  Lump_c *lump = CreateLevelLump(level, "SSECTORS");
 
-  Lump_c *lump = CreateLevelLump(level, "SSECTORS", CalcXnodNodesSize(level));
+  lump->Write(level.bsp_compress ? "ZGLN" : "XGLN", 4);
 
   if (level.bsp_compress) lump->Begin_Zlib();
 
-  lump->Write(level.bsp_compress ? "ZGLN" : "XGLN", 4);
   PutVertices_Xnod(level, lump);
   PutSubsecs_Xnod(level, lump);
   PutSegs_Xgln(level, lump);
@@ -1017,13 +834,14 @@ void SaveDoom_XGL2(level_t &level, node_t *root_node)
   // leave SEGS empty
   CreateLevelLump(level, "SEGS")->Finish();
 
-  SortSegs(level);
+  CollectSegs(level);
 
-  Lump_c *lump = CreateLevelLump(level, "SSECTORS", CalcXnodNodesSize(level));
+  Lump_c *lump = CreateLevelLump(level, "SSECTORS");
+
+  lump->Write(level.bsp_compress ? "ZGL2" : "XGL2", 4);
 
   if (level.bsp_compress) lump->Begin_Zlib();
 
-  lump->Write(level.bsp_compress ? "ZGL2" : "XGL2", 4);
   PutVertices_Xnod(level, lump);
   PutSubsecs_Xnod(level, lump);
   PutSegs_Xgl2(level, lump);
@@ -1044,13 +862,14 @@ void SaveDoom_XGL3(level_t &level, node_t *root_node)
   // leave SEGS empty
   CreateLevelLump(level, "SEGS")->Finish();
 
-  SortSegs(level);
+  CollectSegs(level);
+
+  Lump_c *lump = CreateLevelLump(level, "SSECTORS");
 
-  Lump_c *lump = CreateLevelLump(level, "SSECTORS", CalcXnodNodesSize(level));
+  lump->Write(level.bsp_compress ? "ZGL3" : "XGL3", 4);
 
   if (level.bsp_compress) lump->Begin_Zlib();
 
-  lump->Write(level.bsp_compress ? "ZGL3" : "XGL3", 4);
   PutVertices_Xnod(level, lump);
   PutSubsecs_Xnod(level, lump);
   PutSegs_Xgl2(level, lump);
@@ -1079,7 +898,7 @@ void SaveDoom64_DoomBSP(level_t &level, node_t *root_node)
   PutLeafs_Vanilla(level);
   // remove all the minisegs from subsectors
   NormaliseBspTree(level);
-  SortSegs(level);
+  CollectSegs(level);
   PutSegs_Vanilla(level);
   PutSubsecs_Vanilla(level);
   PutNodes_Vanilla(level, root_node);
@@ -1094,7 +913,7 @@ void SaveDoom64_DeePBSPV4(level_t &level, node_t *root_node)
   PutLeafs_DeePBSPV4(level);
   // remove all the minisegs from subsectors
   NormaliseBspTree(level);
-  SortSegs(level);
+  CollectSegs(level);
   PutSegs_DeePBSPV4(level);
   PutSubsecs_DeePBSPV4(level);
   PutNodes_DeePBSPV4(level, root_node);
@@ -1107,12 +926,12 @@ void SaveDoom64_DeePBSPV4(level_t &level, node_t *root_node)
 void SaveTextmap_ZNODES(level_t &level, node_t *root_node)
 {
   auto mark = Benchmarker(__func__);
-  SortSegs(level);
+  CollectSegs(level);
 
-  Lump_c *lump = CreateLevelLump(level, "ZNODES", CalcXnodNodesSize(level));
+  Lump_c *lump = CreateLevelLump(level, "ZNODES");
 
-  lump->Begin_Zlib();
   lump->Write("ZGL3", 4);
+  lump->Begin_Zlib();
   PutVertices_Xnod(level, lump);
   PutSubsecs_Xnod(level, lump);
   PutSegs_Xgl2(level, lump);
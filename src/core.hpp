@@ -37,9 +37,13 @@
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <atomic>
 #include <bit>
 #include <chrono>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 #include "zlib-ng.h"
@@ -408,6 +412,102 @@ constexpr void UtilFree(T *data)
   free(data);
 }
 
+//------------------------------------------------------------------------
+// PROFILING
+//------------------------------------------------------------------------
+
+//
+// Every Benchmarker scope is a node in a per-thread call tree, keyed by
+// name, recursive calls are folded into their outermost scope.  Worker
+// threads start at the scope of their caller, and merge into the main
+// tree when they exit.  ProfileReport prints and resets the tree.
+//
+using profile_path_t = std::vector<const char *>;
+using profile_clock_t = std::chrono::steady_clock;
+
+void ProfileEnter(const char *name);
+void ProfileLeave(profile_clock_t::time_point start, profile_clock_t::time_point end);
+profile_path_t ProfileCurrentPath(void);
+void ProfileAttachPath(const profile_path_t &path);
+void ProfileReport(const char *level_name, const char *filename);
+void WriteProfileJson(const char *filename);
+
+//
+// With --trace, every Benchmarker and Tracer scope is also recorded as a
+// Chrome trace-event span.  Spans go into per-thread buffers, which are
+// handed over whenever they fill up or their thread exits, and the whole
+// timeline is written out when the program exits.
+//
+constexpr int32_t TRACE_DEPTH_BAND = 8;
+
+void TraceStart(const char *filename);
+void TraceSpan(const char *name, profile_clock_t::time_point start, profile_clock_t::time_point end,
+               const char *arg_name = nullptr, int64_t arg = 0);
+const char *TraceName(const char *name);
+
+//------------------------------------------------------------------------
+// THREADING
+//------------------------------------------------------------------------
+
+//
+// Number of worker threads to use, never less than one.
+//
+inline size_t ThreadCount(void)
+{
+  return std::max(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(1));
+}
+
+//
+// Run func(i) for every i in [0, count), spread across all cores.
+// Work items are handed out one by one, so their order of execution is
+// undefined, the caller must store results by index.
+//
+template <typename F>
+inline void ParallelFor(size_t count, const F &func)
+{
+  size_t num_threads = std::min(ThreadCount(), count);
+
+  if (num_threads <= 1)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      func(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  profile_path_t path = ProfileCurrentPath();
+
+  auto worker = [&next, &func, count](void)
+  {
+    for (size_t i = next++; i < count; i = next++)
+    {
+      func(i);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(num_threads - 1);
+
+  for (size_t t = 1; t < num_threads; t++)
+  {
+    pool.emplace_back(
+        [&worker, &path](void)
+        {
+          ProfileAttachPath(path);
+          worker();
+        });
+  }
+
+  worker();
+
+  for (auto &thread : pool)
+  {
+    thread.join();
+  }
+}
+
 //------------------------------------------------------------------------
 // FILE MANAGEMENT
 //------------------------------------------------------------------------
@@ -617,6 +717,29 @@ inline double ComputeAngle(double dx, double dy)
   return angle + (angle < 0.0) * 360.0;
 }
 
+//
+// Pseudo-angle of (dx,dy), going from 0 to 4 anti-clockwise from east,
+// one per quadrant.  It is not linear in the angle, but keeps the same
+// order as ComputeAngle() without any trigonometry.
+//
+inline double ComputePseudoAngle(double dx, double dy)
+{
+  if (dx == 0 && dy == 0)
+  {
+    return 0;
+  }
+
+  const double p = dy / (fabs(dx) + fabs(dy));
+
+  // east -> north -> west is 0 to 2, west -> south -> east is 2 to 4
+  if (dx < 0)
+  {
+    return 2.0 - p;
+  }
+
+  return (p < 0) ? 4.0 + p : p;
+}
+
 inline short_angle_t ComputeAngle_BAM(double dx, double dy)
 {
   double angle = atan2(dy, dx) * 180.0 / M_PI;
@@ -1392,7 +1515,6 @@ struct Wad_file
   std::vector<size_t> tx_tex;
 
   bool begun_write;
-  size_t begun_max_size;
 
   // when >= 0, the next added lump is placed _before_ this
   size_t insert_point;
@@ -1452,15 +1574,13 @@ struct Wad_file
   void RemoveLumps(size_t index, size_t count = 1);
 
   // insert a new lump.
-  // The second form is for a level marker.
-  // The 'max_size' parameter (if >= 0) specifies the most data
-  // you will write into the lump -- writing more will corrupt
-  // something else in the WAD.
-  Lump_c *AddLump(const char *name, size_t max_size = NO_INDEX);
+  // Nothing is placed in the file until Lump_c::Finish(), when the
+  // final size of the lump is known.
+  Lump_c *AddLump(const char *name);
 
   // setup lump to write new data to it.
   // the old contents are lost.
-  void RecreateLump(Lump_c *lump, size_t max_size = NO_INDEX);
+  void RecreateLump(Lump_c *lump);
 
   // set the insertion point -- the next lump will be added *before*
   // this index, and it will be incremented so that a sequence of
@@ -1491,12 +1611,12 @@ struct Wad_file
   size_t FindFreeSpace(size_t length);
 
   // find a place (possibly at end of WAD) where we can write some
-  // data of max_size (-1 means unlimited), and seek to that spot
-  // (possibly writing some padding zeros -- the difference should
-  // be no more than a few bytes).  Returns new position.
-  size_t PositionForWrite(size_t max_size = NO_INDEX);
+  // data of the given length (-1 means unlimited), and seek to that
+  // spot (possibly writing some padding zeros -- the difference
+  // should be no more than a few bytes).  Returns new position.
+  size_t PositionForWrite(size_t length = NO_INDEX);
 
-  void FinishLump(size_t final_size);
+  void FinishLump(void);
   size_t WritePadding(size_t count);
 
   // write the new directory, updating the dir_xxx variables
@@ -1514,9 +1634,14 @@ struct Lump_c
   size_t l_start;
   size_t l_length;
 
+  // data written to the lump is kept here, and only goes into the
+  // file once Finish() is called.
+  std::vector<uint8_t> out_data;
+
+  // when active, everything from zlib_start onwards is compressed
+  // by Finish_Zlib().
   bool zlib_init = false;
-  zng_stream zout_stream;
-  uint8_t zout_buffer[1024];
+  size_t zlib_start = 0;
 
   void MakeEntry(raw_wad_entry_t *entry);
 
@@ -1564,107 +1689,47 @@ struct Lump_c
   // write some data to the lump.  Only the lump which had just
   // been created with Wad_file::AddLump() or RecreateLump() can be
   // written to.
-  bool Write(const void *data, const size_t len)
+  void Write(const void *data, const size_t len)
   {
     SYS_ASSERT(data && len > 0);
-    l_length += len;
-    return (fwrite(data, len, 1, parent->fp) == 1);
+
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    out_data.insert(out_data.end(), bytes, bytes + len);
   }
 
-  // mark the lump as finished (after writing data to it).
-  void Finish(void)
+  // write a single little-endian integer to the lump.
+  template <typename T>
+  void Put(T value)
   {
-    if (l_length == 0)
-    {
-      l_start = 0;
-    }
+    static_assert(std::is_integral_v<T>, "Put: integral required");
 
-    parent->FinishLump(l_length);
+    value = GetLittleEndian(value);
+    Write(&value, sizeof(T));
   }
 
+  // number of bytes written so far.
+  [[nodiscard]] size_t Written(void) const
+  {
+    return out_data.size();
+  }
+
+  // mark the lump as finished (after writing data to it).
+  // this is where the data is placed in the wad and written out.
+  void Finish(void);
+
   //
   // Zlib compression support
   //
 
+  // everything written after this call, until Finish_Zlib(), will
+  // be compressed.
   void Begin_Zlib(void)
   {
     zlib_init = true;
-    zout_stream.zalloc = nullptr;
-    zout_stream.zfree = nullptr;
-    zout_stream.opaque = nullptr;
-    if (Z_OK != zng_deflateInit(&zout_stream, Z_DEFAULT_COMPRESSION))
-    {
-      PrintLine(LOG_ERROR, "ERROR: Trouble starting Zlib compression.");
-    }
-    zout_stream.next_out = zout_buffer;
-    zout_stream.avail_out = sizeof(zout_buffer);
-  }
-
-  void WriteZ(const void *data, uint32_t length)
-  {
-    if (!zlib_init)
-    {
-      this->Write(data, length);
-      return;
-    }
-
-    SYS_ASSERT(length > 0);
-
-    zout_stream.next_in = static_cast<const uint8_t *>(data);
-    zout_stream.avail_in = length;
-
-    while (zout_stream.avail_in > 0)
-    {
-      if (Z_OK != zng_deflate(&zout_stream, Z_NO_FLUSH))
-      {
-        PrintLine(LOG_ERROR, "ERROR: Trouble Zlib compressing %d bytes.", length);
-      }
-
-      if (zout_stream.avail_out == 0)
-      {
-        this->Write(zout_buffer, sizeof(zout_buffer));
-
-        zout_stream.next_out = zout_buffer;
-        zout_stream.avail_out = sizeof(zout_buffer);
-      }
-    }
+    zlib_start = out_data.size();
   }
 
-  void Finish_Zlib(void)
-  {
-    zlib_init = false;
-    SYS_ASSERT(zout_stream.avail_out > 0)
-    size_t left_over;
-
-    zout_stream.next_in = Z_NULL;
-    zout_stream.avail_in = 0;
-
-    while (true)
-    {
-      int32_t err = zng_deflate(&zout_stream, Z_FINISH);
-
-      if (err == Z_STREAM_END) break;
-
-      if (err != Z_OK)
-      {
-        PrintLine(LOG_ERROR, "ERROR: Trouble finishing Zlib compression.");
-      }
-
-      if (zout_stream.avail_out == 0)
-      {
-        this->Write(zout_buffer, sizeof(zout_buffer));
-
-        zout_stream.next_out = zout_buffer;
-        zout_stream.avail_out = sizeof(zout_buffer);
-      }
-    }
-
-    left_over = sizeof(zout_buffer) - zout_stream.avail_out;
-
-    if (left_over > 0) this->Write(zout_buffer, left_over);
-
-    zng_deflateEnd(&zout_stream);
-  }
+  void Finish_Zlib(void);
 };
 
 //
@@ -1684,16 +1749,21 @@ enum token_kind_e
 
 struct lexer_c
 {
-  explicit lexer_c(const std::string &_data) : data(_data)
+  explicit lexer_c(std::string_view _data) : data(_data)
   {
   }
 
   ~lexer_c(void) = default;
 
-  // parse the next token, storing contents into given string.
-  // returns TOK_EOF at the end of the data, and TOK_ERROR when a
-  // problem is encountered (s will be an error message).
-  token_kind_e Next(std::string &s);
+  // parse the next token, the given view is pointed at its contents
+  // inside the data, nothing is copied.  returns TOK_EOF at the end of
+  // the data, and TOK_ERROR when a problem is encountered.
+  token_kind_e Next(std::string_view &s);
+
+  // check if the next token is the given symbol.  if it matches, the
+  // token is consumed and true is returned.  if not, false is returned
+  // and the position is unchanged.
+  bool Match(char ch);
 
   // check if the next token is an identifier or symbol matching the
   // given string.  the match is not case-sensitive.  if it matches,
@@ -1704,27 +1774,38 @@ struct lexer_c
   // rewind to the very beginning.
   void Rewind(void);
 
-  const std::string &data;
+  // skip over the value of a field, stopping at the ';' which ends it
+  // (or at a '}', '=' or the end of data when that is missing).
+  // nothing is tokenized, which makes it a lot faster than Next().
+  // returns false if the value is empty.
+  bool SkipValue(void);
+
+  // skip over the rest of a block, including the closing '}'.
+  // returns false if the data ended before the block did.
+  bool SkipBlock(void);
+
+  std::string_view data;
 
   size_t pos = 0;
   size_t line = 1;
 
   void SkipToNext();
 
-  token_kind_e ParseIdentifier(std::string &s);
-  token_kind_e ParseNumber(std::string &s);
-  token_kind_e ParseString(std::string &s);
-
-  void ParseEscape(std::string &s);
+  token_kind_e ParseIdentifier(std::string_view &s);
+  token_kind_e ParseNumber(std::string_view &s);
+  token_kind_e ParseString(std::string_view &s);
 };
 
 // helpers for converting numeric tokens.
-size_t LEX_Index(const std::string &s);
-int16_t LEX_Int16(const std::string &s);
-int32_t LEX_Int(const std::string &s);
-uint32_t LEX_UInt(const std::string &s);
-double LEX_Double(const std::string &s);
-bool LEX_Boolean(const std::string &s);
+size_t LEX_Index(std::string_view s);
+int16_t LEX_Int16(std::string_view s);
+int32_t LEX_Int(std::string_view s);
+uint32_t LEX_UInt(std::string_view s);
+double LEX_Double(std::string_view s);
+bool LEX_Boolean(std::string_view s);
+
+// case-insensitive comparison of an identifier token.
+bool LEX_Equal(std::string_view s, std::string_view name);
 
 //
 // Node Build Information Structure
@@ -1734,6 +1815,32 @@ constexpr double SPLIT_COST_MIN = 1.0;
 constexpr double SPLIT_COST_DEFAULT = 11.0;
 constexpr double SPLIT_COST_MAX = 32.0;
 
+// how the node builder divides its quadtrees, see --quadtree
+using quadtree_policy_t = enum quadtree_policy_e : uint8_t
+{
+  QUAD_Auto,  // seg-count leaves, with the limit taken from the seg density
+  QUAD_Fixed, // leaves of a fixed size, the classic behavior
+  QUAD_Segs,  // only divide boxes holding more than a number of segs
+  QUAD_SAH,   // only divide boxes when it lowers the estimated test cost
+};
+
+// zlib compression levels for --compress-level, from fastest to smallest
+constexpr int32_t ZLIB_LEVEL_MIN = 1;
+constexpr int32_t ZLIB_LEVEL_MAX = 9;
+constexpr int32_t ZLIB_LEVEL_DEFAULT = 6;
+
+constexpr int32_t QUAD_SIZE_DEFAULT = 320;
+constexpr size_t QUAD_SEGS_DEFAULT = 64;
+
+// what --auto-cost tries to minimize (or maximize, for quality)
+using auto_cost_objective_t = enum auto_cost_objective_e : uint8_t
+{
+  AUTO_COST_Segs,
+  AUTO_COST_Nodes,
+  AUTO_COST_Depth,
+  AUTO_COST_Quality,
+};
+
 using buildinfo_t = struct buildinfo_s;
 
 extern buildinfo_t config;
@@ -1749,17 +1856,25 @@ struct buildinfo_s
   } polyobj;
 
   double split_cost = SPLIT_COST_DEFAULT;
-  size_t total_warnings = 0;
+  std::atomic<size_t> total_warnings = 0;
   uint32_t debug = DEBUG_NONE;
 
   bsp_format_t bsp_format = bsp_format_t::BSP_XNOD;
   bmap_format_t bmap_format = bmap_format_t::BMAP_DoomBSP;
+  auto_cost_objective_t auto_cost_objective = AUTO_COST_Segs;
+  quadtree_policy_t quad_policy = QUAD_Auto;
+  int32_t quad_size = QUAD_SIZE_DEFAULT;
+  size_t quad_segs = QUAD_SEGS_DEFAULT;
+  bool auto_cost = false; // search for the best split cost
   bool fast = false;     // use a faster method to pick nodes
+  bool quality = false;  // pick nodes from a sample of the segs
   bool backup = false;   // keep a copy of the WAD
   bool analysis = false; // write out CSV for data analysis and visualization
   bool verbose = false;  // this affects how some messages are shown
   bool effects = true;   // disable special effects
   bool compress = false; // compress lumps using zlib
+  int32_t compress_level = ZLIB_LEVEL_DEFAULT;
+  bool trace = false;    // record a timeline for --trace
 };
 
 struct AnalysisData
@@ -1792,6 +1907,7 @@ constexpr const char PRINT_HELP[] = "\n"
                                     "    -v --verbose       Verbose output, show all warnings\n"
                                     "    -b --backup        Backup input files (.bak extension)\n"
                                     "    -f --fast          Faster partition selection\n"
+                                    "    -q --quality       Sampled partition selection\n"
                                     "    -m --map   XXXX    Control which map(s) are built\n"
                                     "    -c --cost  ##      Cost assigned to seg splits (1-32)\n"
                                     "\n"
@@ -1814,7 +1930,11 @@ using build_result_t = enum build_result_e
 // buildinfo_t interface is called.
 void OpenWad(const char *filename);
 
-// close a previously opened wad.
+// open a copy of the wad being built, which gets the same levels saved
+// with another BSP format.  Must be called after OpenWad().
+void OpenExtraWad(const char *filename, bsp_format_t format);
+
+// close a previously opened wad, and any extra ones.
 void CloseWad(void);
 
 // give the number of levels detected in the wad.
@@ -1835,24 +1955,51 @@ void WriteAnalysis(const char *filename);
 
 struct Benchmarker
 {
-  using clock = std::chrono::steady_clock;
+  using clock = profile_clock_t;
   clock::time_point start;
-  const char *name;
   bool enabled;
 
   Benchmarker(const char *_name, bool _enabled = true)
   {
-    if (!_enabled) return;
     enabled = _enabled;
-    name = _name;
+    if (!enabled) return;
+    ProfileEnter(_name);
     start = clock::now();
   };
 
   ~Benchmarker(void)
   {
     if (!enabled) return;
-    auto end = clock::now();
-    auto time = std::chrono::duration<double, std::milli>(end - start);
-    PrintLine(LOG_NORMAL, "[Benchmarker] '%s' runtime: %.2f ms", name, time.count());
+    ProfileLeave(start, clock::now());
+  };
+};
+
+//
+// A span which only shows up in the --trace timeline
+//
+
+struct Tracer
+{
+  using clock = profile_clock_t;
+  clock::time_point start;
+  const char *name;
+  const char *arg_name;
+  int64_t arg;
+  bool enabled;
+
+  Tracer(const char *_name, const char *_arg_name = nullptr, int64_t _arg = 0, bool _enabled = true)
+  {
+    name = _name;
+    arg_name = _arg_name;
+    arg = _arg;
+    enabled = _enabled && config.trace;
+    if (!enabled) return;
+    start = clock::now();
+  };
+
+  ~Tracer(void)
+  {
+    if (!enabled) return;
+    TraceSpan(name, start, clock::now(), arg_name, arg);
   };
 };
@@ -110,92 +110,263 @@ static void ComputeTotalBspHeights(const node_t *node, size_t depth, double &lea
   }
 }
 
+void ComputeAnalysis(const level_t &level, const node_t *root, AnalysisData &data)
+{
+  // Using 'double's to get around strict type casting
+  // and implicit conversion warnings
+  double left_size = 0.0;
+  double right_size = 0.0;
+  double total_depth_sum = 0.0;
+
+  double num_leafs = 0.0;
+  double optimal_depth = 0.0;
+  double expected_leafs_for_optimal_depth = 0.0;
+
+  // external path length
+  double min_epl = 0.0;
+  double max_epl = 0.0;
+
+  data.vertex = level.num_old_vert;
+  data.lines = level.linedefs.size();
+  data.sides = level.sidedefs.size();
+  data.sectors = level.sectors.size();
+
+  data.bsp_vertex = level.num_new_vert;
+  data.nodes = level.nodes.size();
+  data.subsecs = level.subsecs.size();
+  data.segs = level.segs.size();
+
+  // TODO: sidedef math should account for non-seg-generating sides, actually
+  data.splits = level.segs.size() - level.sidedefs.size();
+  num_leafs = static_cast<double>(data.subsecs);
+
+  // a single convex subsector, there is no tree to speak of
+  if (root == nullptr)
+  {
+    return;
+  }
+
+  ComputeTotalBspHeights(root, 0, total_depth_sum);
+  data.left_depth = ComputeBspHeight(root->l.node);
+  data.right_depth = ComputeBspHeight(root->r.node);
+
+  left_size = static_cast<double>(data.left_depth);
+  right_size = static_cast<double>(data.right_depth);
+
+  data.average_depth = total_depth_sum / num_leafs;
+
+  optimal_depth = ceil(log2(num_leafs));
+
+  data.optimal_depth = static_cast<size_t>(optimal_depth);
+  data.tree_balance = (left_size < right_size) ? left_size / right_size : right_size / left_size;
+
+  // math pulled from Marc Rousseau's BSPInfo utility
+  expected_leafs_for_optimal_depth = pow(2, static_cast<double>(data.optimal_depth)); // 2 to the power N
+  min_epl = num_leafs * (optimal_depth + 1) - expected_leafs_for_optimal_depth;
+  max_epl = num_leafs * ((num_leafs - 1) / 2 + 1) - 1;
+  data.worst_case_ratio = min_epl / max_epl;
+  data.tree_quality = ((min_epl / total_depth_sum) - data.worst_case_ratio) / (1 - data.worst_case_ratio);
+}
+
+// builds one sweep point against its own view of the level, and returns
+// the resulting CSV line.
+static std::string AnalyzeBuild(const level_t &level, bool is_fast, size_t split_cost)
+{
+  AnalysisData data;
+  node_t *analysis_node = nullptr;
+  subsec_t *analysis_sub = nullptr;
+  seg_t *analysis_seg = nullptr;
+
+  level_t view = CreateLevelView(level);
+
+  bbox_t dummy = {0, 0, 0, 0};
+  analysis_seg = CreateSegs(view);
+  BuildNodes(view, analysis_seg, 0, &dummy, &analysis_node, &analysis_sub, static_cast<double>(split_cost), is_fast, true);
+
+  ComputeAnalysis(view, analysis_node, data);
+
+  FreeLevelView(view, level);
+
+  return std::format("{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{}", level.GetLevelName(), is_fast, split_cost,
+                     data.vertex, data.lines, data.sides, data.sectors, data.bsp_vertex, data.nodes, data.subsecs, data.segs,
+                     data.splits, data.left_depth, data.right_depth, data.average_depth, data.optimal_depth,
+                     data.tree_balance, data.worst_case_ratio, data.tree_quality);
+}
+
 void GenerateAnalysis(level_t &level, const char *filename)
 {
   auto mark = Benchmarker(__func__);
-  auto generate_analysis_data = [](level_t &level, bool is_fast, size_t split_cost) -> auto
-  {
-    AnalysisData data;
-    node_t *analysis_node = nullptr;
-    subsec_t *analysis_sub = nullptr;
-    seg_t *analysis_seg = nullptr;
-
-    // Using 'double's to get around strict type casting
-    // and implicit conversion warnings
-    double left_size = 0.0;
-    double right_size = 0.0;
-    double total_depth_sum = 0.0;
-
-    double num_leafs = 0.0;
-    double optimal_depth = 0.0;
-    double expected_leafs_for_optimal_depth = 0.0;
-
-    // external path length
-    double min_epl = 0.0;
-    double max_epl = 0.0;
-
-    bbox_t dummy = {0, 0, 0, 0};
-    analysis_seg = CreateSegs(level);
-    BuildNodes(level, analysis_seg, 0, &dummy, &analysis_node, &analysis_sub, static_cast<double>(split_cost), is_fast, true);
-
-    // TODO: pass level data by context instead of globally :v
-    data.vertex = level.num_old_vert;
-    data.lines = level.linedefs.size();
-    data.sides = level.sidedefs.size();
-    data.sectors = level.sectors.size();
-
-    data.bsp_vertex = level.num_new_vert;
-    data.nodes = level.nodes.size();
-    data.subsecs = level.subsecs.size();
-    data.segs = level.segs.size();
-
-    // TODO: sidedef math should account for non-seg-generating sides, actually
-    data.splits = level.segs.size() - level.sidedefs.size();
-    num_leafs = static_cast<double>(data.subsecs);
-
-    ComputeTotalBspHeights(analysis_node, 0, total_depth_sum);
-    data.left_depth = ComputeBspHeight(analysis_node->l.node);
-    data.right_depth = ComputeBspHeight(analysis_node->r.node);
-
-    left_size = static_cast<double>(data.left_depth);
-    right_size = static_cast<double>(data.right_depth);
-
-    data.average_depth = total_depth_sum / num_leafs;
-
-    optimal_depth = ceil(log2(num_leafs));
-
-    data.optimal_depth = static_cast<size_t>(optimal_depth);
-    data.tree_balance = (left_size < right_size) ? left_size / right_size : right_size / left_size;
-
-    // math pulled from Marc Rousseau's BSPInfo utility
-    expected_leafs_for_optimal_depth = pow(2, static_cast<double>(data.optimal_depth)); // 2 to the power N
-    min_epl = num_leafs * (optimal_depth + 1) - expected_leafs_for_optimal_depth;
-    max_epl = num_leafs * ((num_leafs - 1) / 2 + 1) - 1;
-    data.worst_case_ratio = min_epl / max_epl;
-    data.tree_quality = ((min_epl / total_depth_sum) - data.worst_case_ratio) / (1 - data.worst_case_ratio);
-
-    std::string line = std::format("{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{}", level.GetLevelName(), is_fast,
-                                   split_cost, data.vertex, data.lines, data.sides, data.sectors, data.bsp_vertex, data.nodes,
-                                   data.subsecs, data.segs, data.splits, data.left_depth, data.right_depth, data.average_depth,
-                                   data.optimal_depth, data.tree_balance, data.worst_case_ratio, data.tree_quality);
-    analysis_csv.push_back(line);
-
-    FreeNodes(level);
-    FreeSubsecs(level);
-    FreeSegs(level);
-    ClearNewVertices(level);
-    level.num_new_vert = 0;
+
+  static constexpr size_t SWEEP_COSTS = static_cast<size_t>(SPLIT_COST_MAX);
+
+  // normal mode and fast mode, across all split costs.  every sweep point
+  // builds on its own view of the level, hence they all run in parallel.
+  std::vector<std::string> lines(2 * SWEEP_COSTS);
+
+  ParallelFor(lines.size(),
+              [&level, &lines](size_t i)
+              {
+                bool is_fast = (i >= SWEEP_COSTS);
+                size_t split_cost = (i % SWEEP_COSTS) + 1;
+
+                lines[i] = AnalyzeBuild(level, is_fast, split_cost);
+              });
+
+  for (size_t i = 0; i < lines.size(); i++)
+  {
+    analysis_csv.push_back(lines[i]);
+    PrintLine(LOG_NORMAL, "[%s] Analyzed %s, %s mode, split cost factor of %zu", __func__, level.GetLevelName(),
+              (i >= SWEEP_COSTS) ? "fast" : "normal", (i % SWEEP_COSTS) + 1);
+  }
+}
+
+//------------------------------------------------------------------------
+
+using auto_cost_candidate_t = struct auto_cost_candidate_s
+{
+  bool fast;
+  size_t split_cost;
+
+  level_t view;
+  node_t *root;
+  AnalysisData data;
+};
+
+static double AutoCostScore(const auto_cost_candidate_t &cand)
+{
+  switch (config.auto_cost_objective)
+  {
+  case AUTO_COST_Nodes:
+    return static_cast<double>(cand.data.nodes);
+  case AUTO_COST_Depth:
+    return static_cast<double>(std::max(cand.data.left_depth, cand.data.right_depth));
+  case AUTO_COST_Quality:
+    return -cand.data.tree_quality;
+  case AUTO_COST_Segs:
+  default:
+    return static_cast<double>(cand.data.segs);
+  }
+}
+
+// lower score wins, then fewer segs, then the split cost closest to the
+// default, then normal mode.  this keeps the pick deterministic.
+static bool AutoCostBetter(const auto_cost_candidate_t &A, const auto_cost_candidate_t &B)
+{
+  double score_A = AutoCostScore(A);
+  double score_B = AutoCostScore(B);
+
+  if (score_A != score_B) return score_A < score_B;
+  if (A.data.segs != B.data.segs) return A.data.segs < B.data.segs;
+
+  double dist_A = fabs(static_cast<double>(A.split_cost) - SPLIT_COST_DEFAULT);
+  double dist_B = fabs(static_cast<double>(B.split_cost) - SPLIT_COST_DEFAULT);
+
+  if (dist_A != dist_B) return dist_A < dist_B;
+
+  return !A.fast && B.fast;
+}
+
+node_t *AutoCostBuild(level_t &level)
+{
+  auto mark = Benchmarker(__func__);
+
+  // a coarse sweep, which always includes the default split cost,
+  // followed by a fine sweep around the best coarse point.
+  static constexpr size_t COARSE_STEP = 4;
+
+  static constexpr size_t COST_MIN = static_cast<size_t>(SPLIT_COST_MIN);
+  static constexpr size_t COST_MAX = static_cast<size_t>(SPLIT_COST_MAX);
+  static constexpr size_t COST_DEFAULT = static_cast<size_t>(SPLIT_COST_DEFAULT);
+
+  bool tried[2][COST_MAX + 1] = {};
+
+  std::vector<auto_cost_candidate_t> pending;
+  auto_cost_candidate_t best{};
+  bool have_best = false;
+
+  auto queue = [&](bool fast, size_t split_cost)
+  {
+    if (split_cost < COST_MIN || split_cost > COST_MAX || tried[fast][split_cost])
+    {
+      return;
+    }
+
+    tried[fast][split_cost] = true;
+    pending.push_back(auto_cost_candidate_t{.fast = fast, .split_cost = split_cost, .view = {}, .root = nullptr, .data = {}});
   };
 
-  // normal mode, and fast mode
-  for (size_t is_fast = 0; is_fast <= 1; is_fast++)
+  // build everything queued so far in parallel, keep the best tree
+  auto evaluate = [&](void)
   {
-    // across all split costs
-    for (size_t split_cost = 1; split_cost <= 32; split_cost++)
+    ParallelFor(pending.size(),
+                [&level, &pending](size_t i)
+                {
+                  auto_cost_candidate_t &cand = pending[i];
+                  subsec_t *root_sub = nullptr;
+                  bbox_t dummy = {0, 0, 0, 0};
+
+                  cand.view = CreateLevelView(level);
+
+                  seg_t *seg_list = CreateSegs(cand.view);
+                  BuildNodes(cand.view, seg_list, 0, &dummy, &cand.root, &root_sub, static_cast<double>(cand.split_cost),
+                             cand.fast, false);
+
+                  ComputeAnalysis(cand.view, cand.root, cand.data);
+                });
+
+    for (auto &cand : pending)
+    {
+      if (HAS_BIT(config.debug, DEBUG_BUILDER))
+      {
+        PrintLine(LOG_DEBUG, "[%s] %s mode, split cost %zu: segs %zu nodes %zu depth %zu quality %.4f", __func__,
+                  cand.fast ? "fast" : "normal", cand.split_cost, cand.data.segs, cand.data.nodes,
+                  std::max(cand.data.left_depth, cand.data.right_depth), cand.data.tree_quality);
+      }
+
+      if (!have_best || AutoCostBetter(cand, best))
+      {
+        if (have_best)
+        {
+          FreeLevelView(best.view, level);
+        }
+
+        best = std::move(cand);
+        have_best = true;
+        continue;
+      }
+
+      FreeLevelView(cand.view, level);
+    }
+
+    pending.clear();
+  };
+
+  for (size_t fast = 0; fast <= (config.fast ? 1u : 0u); fast++)
+  {
+    for (size_t split_cost = COST_MIN; split_cost <= COST_MAX; split_cost += COARSE_STEP)
     {
-      generate_analysis_data(level, is_fast != 0, split_cost);
-      PrintLine(LOG_NORMAL, "[%s] Analyzed %s, %s mode, split cost factor of %zu", __func__, level.GetLevelName(),
-                is_fast ? "fast" : "normal", split_cost);
+      queue(fast != 0, split_cost);
     }
+
+    queue(fast != 0, COST_DEFAULT);
+    queue(fast != 0, COST_MAX);
+  }
+
+  evaluate();
+
+  for (size_t delta = 1; delta < COARSE_STEP; delta++)
+  {
+    queue(best.fast, best.split_cost - delta);
+    queue(best.fast, best.split_cost + delta);
   }
+
+  evaluate();
+
+  PrintLine(LOG_NORMAL, "[%s] %s: picked split cost %zu, %s mode (%zu segs, %zu nodes, depth %zu, quality %.4f)", __func__,
+            level.GetLevelName(), best.split_cost, best.fast ? "fast" : "normal", best.data.segs, best.data.nodes,
+            std::max(best.data.left_depth, best.data.right_depth), best.data.tree_quality);
+
+  AdoptLevelView(level, best.view);
+
+  return best.root;
 }
@@ -30,6 +30,15 @@
 
 Wad_file *cur_wad;
 
+// copies of the input wad, each one saved with its own BSP format.
+using extra_wad_t = struct extra_wad_s
+{
+  Wad_file *wad;
+  bsp_format_t format;
+};
+
+static std::vector<extra_wad_t> extra_wads;
+
 int CheckLinedefInsideBox(int xmin, int ymin, int xmax, int ymax, int x1, int y1, int x2, int y2)
 {
   int count = 2;
@@ -184,27 +193,23 @@ node_t *NewNode(level_t &level)
   return N;
 }
 
-walltip_t *NewWallTip(level_t &level)
-{
-  walltip_t *WT = UtilCalloc<walltip_t>(sizeof(walltip_t));
-  level.walltips.push_back(WT);
-  return WT;
-}
+/* ----- free routines ---------------------------- */
 
-intersection_t *NewIntersection(level_t &level)
+void FreeVertex(vertex_t *vertex)
 {
-  intersection_t *cut = new intersection_t;
-  level.intercuts.push_back(cut);
-  return cut;
-}
+  if (vertex->tip_set != nullptr)
+  {
+    UtilFree(vertex->tip_set);
+  }
 
-/* ----- free routines ---------------------------- */
+  UtilFree(vertex);
+}
 
 void FreeVertices(level_t &level)
 {
   for (size_t i = 0; i < level.vertices.size(); i++)
   {
-    UtilFree(level.vertices[i]);
+    FreeVertex(level.vertices[i]);
   }
 
   level.vertices.clear();
@@ -280,24 +285,10 @@ void FreeNodes(level_t &level)
   level.nodes.clear();
 }
 
-void FreeWallTips(level_t &level)
-{
-  for (size_t i = 0; i < level.walltips.size(); i++)
-  {
-    UtilFree(level.walltips[i]);
-  }
-
-  level.walltips.clear();
-}
-
 void FreeIntersections(level_t &level)
 {
-  for (size_t i = 0; i < level.intercuts.size(); i++)
-  {
-    delete level.intercuts[i];
-  }
-
-  level.intercuts.clear();
+  std::vector<intersection_t>().swap(level.cut_list.cuts);
+  std::vector<uint32_t>().swap(level.cut_list.sorted);
 }
 
 /* ----- reading routines ------------------------------ */
@@ -997,119 +988,183 @@ static constexpr uint32_t UDMF_SECTOR = 3;
 static constexpr uint32_t UDMF_SIDEDEF = 4;
 static constexpr uint32_t UDMF_LINEDEF = 5;
 
-static void ParseThingField(thing_t *thing, const std::string &key, token_kind_e kind, const std::string &value)
+// the UDMF spec does not require objects to be in a dependency order.
+// for example: sidedefs may occur *after* the linedefs which refer to
+// them.  hence references are kept as raw indices while parsing, and
+// resolved once the whole TEXTMAP has been read.
+using udmf_line_refs_t = struct udmf_line_refs_s
 {
-  if (key == "x")
-  {
-    thing->x = LEX_Double(value);
-  }
+  size_t v1 = NO_INDEX;
+  size_t v2 = NO_INDEX;
+  size_t front = NO_INDEX;
+  size_t back = NO_INDEX;
+};
 
-  if (key == "y")
-  {
-    thing->y = LEX_Double(value);
-  }
+using udmf_refs_t = struct udmf_refs_s
+{
+  std::vector<size_t> side_sectors;
+  std::vector<udmf_line_refs_t> lines;
+};
 
-  if (key == "type")
+// the only keys the builder cares about, everything else is skipped.
+using udmf_key_t = enum udmf_key_e
+{
+  UDMF_KEY_Other,
+  UDMF_KEY_X,
+  UDMF_KEY_Y,
+  UDMF_KEY_V1,
+  UDMF_KEY_V2,
+  UDMF_KEY_Type,
+  UDMF_KEY_Sector,
+  UDMF_KEY_Special,
+  UDMF_KEY_TwoSided,
+  UDMF_KEY_SideBack,
+  UDMF_KEY_SideFront
+};
+
+static udmf_key_t UDMF_Key(std::string_view key)
+{
+  // switch on length and first character, then confirm the whole key
+  switch (key.size())
   {
-    thing->type = static_cast<doomednum_t>(LEX_Int16(value));
+  case 1:
+    if (LEX_Equal(key, "x")) return UDMF_KEY_X;
+    if (LEX_Equal(key, "y")) return UDMF_KEY_Y;
+    break;
+  case 2:
+    if (LEX_Equal(key, "v1")) return UDMF_KEY_V1;
+    if (LEX_Equal(key, "v2")) return UDMF_KEY_V2;
+    break;
+  case 4:
+    if (LEX_Equal(key, "type")) return UDMF_KEY_Type;
+    break;
+  case 6:
+    if (LEX_Equal(key, "sector")) return UDMF_KEY_Sector;
+    break;
+  case 7:
+    if (LEX_Equal(key, "special")) return UDMF_KEY_Special;
+    break;
+  case 8:
+    switch (key[1] | 0x20)
+    {
+    case 'w':
+      if (LEX_Equal(key, "twosided")) return UDMF_KEY_TwoSided;
+      break;
+    case 'i':
+      if (LEX_Equal(key, "sideback")) return UDMF_KEY_SideBack;
+      break;
+    default:
+      break;
+    }
+    break;
+  case 9:
+    if (LEX_Equal(key, "sidefront")) return UDMF_KEY_SideFront;
+    break;
+  default:
+    break;
   }
+
+  return UDMF_KEY_Other;
 }
 
-static void ParseVertexField(vertex_t *vertex, const std::string &key, token_kind_e kind, const std::string &value)
+static int UDMF_BlockType(std::string_view section)
 {
-  if (key == "x")
-  {
-    vertex->x = LEX_Double(value);
-  }
-
-  if (key == "y")
+  switch (section.size())
   {
-    vertex->y = LEX_Double(value);
+  case 5:
+    if (LEX_Equal(section, "thing")) return UDMF_THING;
+    break;
+  case 6:
+    if (LEX_Equal(section, "vertex")) return UDMF_VERTEX;
+    if (LEX_Equal(section, "sector")) return UDMF_SECTOR;
+    break;
+  case 7:
+    if (LEX_Equal(section, "sidedef")) return UDMF_SIDEDEF;
+    if (LEX_Equal(section, "linedef")) return UDMF_LINEDEF;
+    break;
+  default:
+    break;
   }
-}
 
-static void ParseSectorField(sector_t *sector, const std::string &key, token_kind_e kind, const std::string &value)
-{
-  // nothing actually needed
+  return 0;
 }
 
-static void ParseSidedefField(level_t &level, sidedef_t *side, const std::string &key, token_kind_e kind,
-                              const std::string &value)
+static void ParseThingField(thing_t *thing, udmf_key_t key, token_kind_e kind, std::string_view value)
 {
-  if (key == "sector")
+  switch (key)
   {
-    size_t num = LEX_Index(value);
-
-    if (num >= level.sectors.size())
-    {
-      PrintLine(LOG_ERROR, "ERROR: illegal sector number #%zu", static_cast<size_t>(num));
-    }
-
-    side->sector = level.sectors[num];
+  case UDMF_KEY_X:
+    thing->x = LEX_Double(value);
+    break;
+  case UDMF_KEY_Y:
+    thing->y = LEX_Double(value);
+    break;
+  case UDMF_KEY_Type:
+    thing->type = static_cast<doomednum_t>(LEX_Int16(value));
+    break;
+  default:
+    break;
   }
 }
 
-static void ParseLinedefField(level_t &level, linedef_t *line, const std::string &key, token_kind_e kind,
-                              const std::string &value)
+static void ParseVertexField(vertex_t *vertex, udmf_key_t key, token_kind_e kind, std::string_view value)
 {
-  if (key == "v1")
+  switch (key)
   {
-    line->start = level.SafeLookupVertex(LEX_Index(value), static_cast<size_t>(line - level.linedefs[0]));
+  case UDMF_KEY_X:
+    vertex->x = LEX_Double(value);
+    break;
+  case UDMF_KEY_Y:
+    vertex->y = LEX_Double(value);
+    break;
+  default:
+    break;
   }
+}
 
-  if (key == "v2")
+static void ParseSidedefField(size_t &sector_ref, udmf_key_t key, token_kind_e kind, std::string_view value)
+{
+  if (key == UDMF_KEY_Sector)
   {
-    line->end = level.SafeLookupVertex(LEX_Index(value), static_cast<size_t>(line - level.linedefs[0]));
+    sector_ref = LEX_Index(value);
   }
+}
 
-  if (key == "special")
+static void ParseLinedefField(linedef_t *line, udmf_line_refs_t &refs, udmf_key_t key, token_kind_e kind,
+                              std::string_view value)
+{
+  switch (key)
   {
+  case UDMF_KEY_V1:
+    refs.v1 = LEX_Index(value);
+    break;
+  case UDMF_KEY_V2:
+    refs.v2 = LEX_Index(value);
+    break;
+  case UDMF_KEY_Special:
     line->special = LEX_Int(value);
-  }
-
-  if (key == "twosided")
-  {
+    break;
+  case UDMF_KEY_TwoSided:
     if (LEX_Boolean(value))
     {
       line->effects |= FX_TwoSided;
-    };
-  }
-
-  if (key == "sidefront")
-  {
-    size_t num = LEX_Index(value);
-
-    if (num >= level.sidedefs.size())
-    {
-      line->right = nullptr;
-    }
-    else
-    {
-      line->right = level.sidedefs[num];
-    }
-  }
-
-  if (key == "sideback")
-  {
-    size_t num = LEX_Index(value);
-
-    if (num >= level.sidedefs.size())
-    {
-      line->left = nullptr;
-    }
-    else
-    {
-      line->left = level.sidedefs[num];
     }
+    break;
+  case UDMF_KEY_SideFront:
+    refs.front = LEX_Index(value);
+    break;
+  case UDMF_KEY_SideBack:
+    refs.back = LEX_Index(value);
+    break;
+  default:
+    break;
   }
 }
 
-static void ParseUDMF_Block(level_t &level, lexer_c &lex, int cur_type)
+static void ParseUDMF_Block(level_t &level, udmf_refs_t &refs, lexer_c &lex, int cur_type)
 {
   vertex_t *vertex = nullptr;
   thing_t *thing = nullptr;
-  sector_t *sector = nullptr;
-  sidedef_t *side = nullptr;
   linedef_t *line = nullptr;
 
   switch (cur_type)
@@ -1120,28 +1175,36 @@ static void ParseUDMF_Block(level_t &level, lexer_c &lex, int cur_type)
   case UDMF_THING:
     thing = NewThing(level);
     break;
-  case UDMF_SECTOR:
-    sector = NewSector(level);
-    break;
   case UDMF_SIDEDEF:
-    side = NewSidedef(level);
+    NewSidedef(level);
+    refs.side_sectors.push_back(NO_INDEX);
     break;
   case UDMF_LINEDEF:
     line = NewLinedef(level);
+    refs.lines.emplace_back();
     break;
+
+  // nothing inside a sector is needed, nor in unknown blocks
+  case UDMF_SECTOR:
+    NewSector(level);
+    [[fallthrough]];
   default:
-    break;
+    if (!lex.SkipBlock())
+    {
+      PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: unclosed block");
+    }
+    return;
   }
 
   for (;;)
   {
-    if (lex.Match("}"))
+    if (lex.Match('}'))
     {
       break;
     }
 
-    std::string key;
-    std::string value;
+    std::string_view key;
+    std::string_view value;
 
     token_kind_e tok = lex.Next(key);
 
@@ -1155,11 +1218,28 @@ static void ParseUDMF_Block(level_t &level, lexer_c &lex, int cur_type)
       PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: missing key");
     }
 
-    if (!lex.Match("="))
+    if (!lex.Match('='))
     {
       PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: missing '='");
     }
 
+    udmf_key_t field = UDMF_Key(key);
+
+    // don't even tokenize values which are not needed
+    if (field == UDMF_KEY_Other)
+    {
+      if (!lex.SkipValue())
+      {
+        PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: missing value");
+      }
+
+      if (!lex.Match(';'))
+      {
+        PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: missing ';'");
+      }
+      continue;
+    }
+
     tok = lex.Next(value);
 
     if (tok == TOK_EOF || tok == TOK_ERROR || value == "}")
@@ -1167,7 +1247,7 @@ static void ParseUDMF_Block(level_t &level, lexer_c &lex, int cur_type)
       PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: missing value");
     }
 
-    if (!lex.Match(";"))
+    if (!lex.Match(';'))
     {
       PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: missing ';'");
     }
@@ -1175,50 +1255,31 @@ static void ParseUDMF_Block(level_t &level, lexer_c &lex, int cur_type)
     switch (cur_type)
     {
     case UDMF_VERTEX:
-      ParseVertexField(vertex, key, tok, value);
+      ParseVertexField(vertex, field, tok, value);
       break;
     case UDMF_THING:
-      ParseThingField(thing, key, tok, value);
-      break;
-    case UDMF_SECTOR:
-      ParseSectorField(sector, key, tok, value);
+      ParseThingField(thing, field, tok, value);
       break;
     case UDMF_SIDEDEF:
-      ParseSidedefField(level, side, key, tok, value);
+      ParseSidedefField(refs.side_sectors.back(), field, tok, value);
       break;
     case UDMF_LINEDEF:
-      ParseLinedefField(level, line, key, tok, value);
+      ParseLinedefField(line, refs.lines.back(), field, tok, value);
       break;
 
     default: /* just skip it */
       break;
     }
   }
-
-  // validate stuff
-
-  if (line != nullptr)
-  {
-    if (line->start == nullptr || line->end == nullptr)
-    {
-      PrintLine(LOG_ERROR, "ERROR: Linedef #%zu is missing a vertex!", line->index);
-    }
-
-    ValidateLinedef(level, line);
-  }
 }
 
-static void ParseUDMF_Pass(level_t &level, const std::string &data, int pass)
+static void ParseUDMF_Pass(level_t &level, udmf_refs_t &refs, std::string_view data)
 {
-  // pass = 1 : vertices, sectors, things
-  // pass = 2 : sidedefs
-  // pass = 3 : linedefs
-
   lexer_c lex(data);
 
   for (;;)
   {
-    std::string section;
+    std::string_view section;
     token_kind_e tok = lex.Next(section);
 
     if (tok == TOK_EOF)
@@ -1233,102 +1294,218 @@ static void ParseUDMF_Pass(level_t &level, const std::string &data, int pass)
     }
 
     // ignore top-level assignments
-    if (lex.Match("="))
+    if (lex.Match('='))
     {
       lex.Next(section);
-      if (!lex.Match(";"))
+      if (!lex.Match(';'))
       {
         PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: missing ';'");
       }
       continue;
     }
 
-    if (!lex.Match("{"))
+    if (!lex.Match('{'))
     {
       PrintLine(LOG_ERROR, "ERROR: Malformed TEXTMAP lump: missing '{'");
     }
 
-    int cur_type = 0;
+    // process the block
+    ParseUDMF_Block(level, refs, lex, UDMF_BlockType(section));
+  }
+}
+
+// a slice of the TEXTMAP, parsed on its own into a scratch level.
+using udmf_chunk_t = struct udmf_chunk_s
+{
+  std::string_view data;
+  level_t level;
+  udmf_refs_t refs;
+};
+
+// below this size, splitting the TEXTMAP costs more than it gains
+static constexpr size_t UDMF_CHUNK_MIN = 256 * 1024;
 
-    if (section == "thing")
+//
+// Split the TEXTMAP into roughly even pieces, cutting only after a
+// top-level block.  Strings and comments are stepped over, so that any
+// braces inside them are not counted.
+//
+static void SplitUDMF_Chunks(std::string_view data, size_t count, std::vector<udmf_chunk_t> &chunks)
+{
+  size_t step = data.size() / count;
+  size_t start = 0;
+  size_t depth = 0;
+
+  for (size_t pos = 0; pos < data.size(); pos++)
+  {
+    switch (data[pos])
     {
-      if (pass == 1)
+    case '"':
+      for (pos++; pos < data.size() && data[pos] != '"'; pos++)
       {
-        cur_type = UDMF_THING;
+        if (data[pos] == '\\')
+        {
+          pos++;
+        }
       }
-    }
-    else if (section == "vertex")
-    {
-      if (pass == 1)
+      break;
+
+    case '/':
+      if (pos + 1 < data.size() && data[pos + 1] == '/')
       {
-        cur_type = UDMF_VERTEX;
+        pos = std::min(data.find('\n', pos), data.size());
       }
-    }
-    else if (section == "sector")
-    {
-      if (pass == 1)
+      else if (pos + 1 < data.size() && data[pos + 1] == '*')
       {
-        cur_type = UDMF_SECTOR;
+        pos = std::min(data.find("*/", pos + 2), data.size()) + 1;
       }
-    }
-    else if (section == "sidedef")
-    {
-      if (pass == 2)
+      break;
+
+    case '{':
+      depth++;
+      break;
+
+    case '}':
+      if (depth > 0)
       {
-        cur_type = UDMF_SIDEDEF;
+        depth--;
       }
-    }
-    else if (section == "linedef")
-    {
-      if (pass == 3)
+
+      if (depth == 0 && pos + 1 - start >= step && chunks.size() + 1 < count)
       {
-        cur_type = UDMF_LINEDEF;
+        chunks.emplace_back().data = data.substr(start, pos + 1 - start);
+        start = pos + 1;
       }
+      break;
+
+    default:
+      break;
     }
+  }
 
-    // process the block
-    ParseUDMF_Block(level, lex, cur_type);
+  if (start < data.size())
+  {
+    chunks.emplace_back().data = data.substr(start);
   }
 }
 
-void ParseUDMF(level_t &level)
+template <typename T>
+static void AppendUDMF_Objects(std::vector<T *> &dest, std::vector<T *> &src)
 {
-  Lump_c *lump = level.FindLevelLump("TEXTMAP");
-
-  if (lump == nullptr || !lump->Seek(0))
+  for (T *obj : src)
   {
-    PrintLine(LOG_ERROR, "ERROR: Failure finding TEXTMAP lump.");
+    obj->index = dest.size();
+    dest.push_back(obj);
   }
 
-  size_t remain = lump->Length();
+  src.clear();
+}
+
+//
+// Parse the pieces on all cores, then stitch the results together in
+// file order.  The references are global TEXTMAP indices already, so
+// they are simply appended too.
+//
+static void ParseUDMF_Parallel(level_t &level, udmf_refs_t &refs, std::string_view data, size_t count)
+{
+  std::vector<udmf_chunk_t> chunks;
+  chunks.reserve(count);
 
-  // load the lump into this string
-  std::string data;
+  SplitUDMF_Chunks(data, count, chunks);
 
-  while (remain > 0)
+  ParallelFor(chunks.size(),
+              [&chunks](size_t i)
+              {
+                udmf_chunk_t &chunk = chunks[i];
+                ParseUDMF_Pass(chunk.level, chunk.refs, chunk.data);
+              });
+
+  for (auto &chunk : chunks)
   {
-    char buffer[4096];
+    AppendUDMF_Objects(level.vertices, chunk.level.vertices);
+    AppendUDMF_Objects(level.sectors, chunk.level.sectors);
+    AppendUDMF_Objects(level.sidedefs, chunk.level.sidedefs);
+    AppendUDMF_Objects(level.linedefs, chunk.level.linedefs);
+    AppendUDMF_Objects(level.things, chunk.level.things);
+
+    refs.side_sectors.insert(refs.side_sectors.end(), chunk.refs.side_sectors.begin(), chunk.refs.side_sectors.end());
+    refs.lines.insert(refs.lines.end(), chunk.refs.lines.begin(), chunk.refs.lines.end());
+  }
+}
 
-    size_t want = std::min(remain, sizeof(buffer));
+static void ResolveUDMF_Refs(level_t &level, const udmf_refs_t &refs)
+{
+  for (size_t i = 0; i < level.sidedefs.size(); i++)
+  {
+    size_t num = refs.side_sectors[i];
 
-    if (!lump->Read(buffer, want))
+    if (num == NO_INDEX)
     {
-      PrintLine(LOG_ERROR, "ERROR: Failure reading TEXTMAP lump.");
+      continue;
     }
 
-    data.append(buffer, want);
+    if (num >= level.sectors.size())
+    {
+      PrintLine(LOG_ERROR, "ERROR: illegal sector number #%zu", num);
+    }
 
-    remain -= want;
+    level.sidedefs[i]->sector = level.sectors[num];
   }
 
-  // now parse it...
+  for (size_t i = 0; i < level.linedefs.size(); i++)
+  {
+    linedef_t *line = level.linedefs[i];
+    const udmf_line_refs_t &ref = refs.lines[i];
 
-  // the UDMF spec does not require objects to be in a dependency order.
-  // for example: sidedefs may occur *after* the linedefs which refer to
-  // them.  hence we perform multiple passes over the TEXTMAP data.
-  ParseUDMF_Pass(level, data, 1);
-  ParseUDMF_Pass(level, data, 2);
-  ParseUDMF_Pass(level, data, 3);
+    if (ref.v1 == NO_INDEX || ref.v2 == NO_INDEX)
+    {
+      PrintLine(LOG_ERROR, "ERROR: Linedef #%zu is missing a vertex!", line->index);
+    }
+
+    line->start = level.SafeLookupVertex(ref.v1, i);
+    line->end = level.SafeLookupVertex(ref.v2, i);
+
+    // out-of-range sides are silently treated as missing
+    line->right = (ref.front < level.sidedefs.size()) ? level.sidedefs[ref.front] : nullptr;
+    line->left = (ref.back < level.sidedefs.size()) ? level.sidedefs[ref.back] : nullptr;
+
+    ValidateLinedef(level, line);
+  }
+}
+
+void ParseUDMF(level_t &level)
+{
+  Lump_c *lump = level.FindLevelLump("TEXTMAP");
+
+  if (lump == nullptr || !lump->Seek(0))
+  {
+    PrintLine(LOG_ERROR, "ERROR: Failure finding TEXTMAP lump.");
+  }
+
+  // load the whole lump at once, the lexer works on views into it
+  std::string data(lump->Length(), '\0');
+
+  if (data.size() > 0 && !lump->Read(data.data(), data.size()))
+  {
+    PrintLine(LOG_ERROR, "ERROR: Failure reading TEXTMAP lump.");
+  }
+
+  // now parse it, in a single pass...
+  udmf_refs_t refs;
+
+  size_t count = std::min(data.size() / UDMF_CHUNK_MIN, ThreadCount());
+
+  if (count > 1)
+  {
+    ParseUDMF_Parallel(level, refs, data, count);
+  }
+  else
+  {
+    ParseUDMF_Pass(level, refs, data);
+  }
+
+  // ...then hook up the sidedefs and linedefs
+  ResolveUDMF_Refs(level, refs);
 
   level.num_old_vert = level.vertices.size();
 }
@@ -1366,9 +1543,14 @@ static void CheckBinaryFormatLimits(level_t &level)
   }
 }
 
-bsp_format_t CheckFormatBSP(buildinfo_t &ctx, level_t &level)
+//
+// Returns the format a BSP tree can really be saved in, and sets
+// 'overflow' when DoomBSP has to be bumped.  The caller warns about it
+// once for all the outputs.
+//
+static bsp_format_t CheckFormatBSP(bsp_format_t format, const level_t &level, bool &overflow)
 {
-  bsp_format_t level_type = ctx.bsp_format;
+  bsp_format_t level_type = format;
 
   if (level.map_format == MapFormat_Doom64)
   {
@@ -1384,8 +1566,7 @@ bsp_format_t CheckFormatBSP(buildinfo_t &ctx, level_t &level)
        || level.subsecs.size() > LIMIT_SUBSEC //
        || level.segs.size() > LIMIT_SEG))     //
   {
-    PrintLine(LOG_NORMAL, "WARNING: BSP overflow. Forcing DeePBSPV4 node format.");
-    config.total_warnings++;
+    overflow = true;
     level_type = BSP_DeePBSPV4;
   }
 
@@ -1463,6 +1644,43 @@ void LoadLevel(level_t &level)
   }
 }
 
+level_t CreateLevelView(const level_t &level)
+{
+  // the pointer vectors are copied, not what they point to
+  return level;
+}
+
+template <typename T>
+static void FreeViewObjects(std::vector<T *> &view_list, size_t shared, void (*release)(T *))
+{
+  for (size_t i = shared; i < view_list.size(); i++)
+  {
+    release(view_list[i]);
+  }
+
+  view_list.clear();
+}
+
+void FreeLevelView(level_t &view, const level_t &level)
+{
+  FreeViewObjects<vertex_t>(view.vertices, level.vertices.size(), FreeVertex);
+  FreeViewObjects<seg_t>(view.segs, level.segs.size(), UtilFree);
+  FreeViewObjects<subsec_t>(view.subsecs, level.subsecs.size(), UtilFree);
+  FreeViewObjects<node_t>(view.nodes, level.nodes.size(), UtilFree);
+  FreeIntersections(view);
+}
+
+void AdoptLevelView(level_t &level, level_t &view)
+{
+  level.vertices = std::move(view.vertices);
+  level.segs = std::move(view.segs);
+  level.subsecs = std::move(view.subsecs);
+  level.nodes = std::move(view.nodes);
+
+  level.num_old_vert = view.num_old_vert;
+  level.num_new_vert = view.num_new_vert;
+}
+
 void FreeLevel(level_t &level)
 {
   FreeVertices(level);
@@ -1473,7 +1691,6 @@ void FreeLevel(level_t &level)
   FreeSegs(level);
   FreeSubsecs(level);
   FreeNodes(level);
-  FreeWallTips(level);
   FreeIntersections(level);
 }
 
@@ -1498,12 +1715,8 @@ static void AddMissingLump(level_t &level, const char *name, const char *after)
   cur_wad->AddLump(name)->Finish();
 }
 
-build_result_e SaveLevelBinaryFormat(level_t &level, node_t *root_node)
+static void AddMissingBinaryLumps(level_t &level)
 {
-  // Note: root_node may be nullptr
-
-  cur_wad->BeginWrite();
-
   // ensure all necessary level lumps are present
   AddMissingLump(level, "SEGS", "VERTEXES");
   AddMissingLump(level, "SSECTORS", "SEGS");
@@ -1517,19 +1730,66 @@ build_result_e SaveLevelBinaryFormat(level_t &level, node_t *root_node)
   {
     AddMissingLump(level, "LEAFS", "BLOCKMAP");
   }
+}
 
-  // check for overflows...
-  CheckBinaryFormatLimits(level);
+//
+// Copy a level lump as it was written into another wad, nothing is
+// done when that wad lacks it.
+//
+static void CopyLevelLump(level_t &level, Wad_file *from, const char *name)
+{
+  size_t idx = from->LevelLookupLump(level.level_num, name);
 
-  // If using DoomBSP format, bump to DeePBSPV4 on overflow
-  RaiseValue(level.bsp_format, CheckFormatBSP(config, level));
+  if (idx == NO_INDEX)
+  {
+    return;
+  }
 
-  // Using Zlib-compressed version of ZDBSP lump format
-  level.bsp_compress |= config.compress;
+  Lump_c *source = from->GetLump(idx);
+  std::vector<uint8_t> data(source->Length());
+
+  if (!data.empty())
+  {
+    if (!source->Seek(0) || !source->Read(data.data(), data.size()))
+    {
+      PrintLine(LOG_ERROR, "ERROR: Failure reading %s lump.", name);
+    }
+  }
+
+  Lump_c *lump = CreateLevelLump(level, name);
+
+  if (!data.empty())
+  {
+    lump->Write(data.data(), data.size());
+  }
+
+  lump->Finish();
+}
+
+static void CopyBlockmapAndReject(level_t &level, Wad_file *from)
+{
+  CopyLevelLump(level, from, "BLOCKMAP");
+  CopyLevelLump(level, from, "REJECT");
+}
+
+//
+// Save the level in a BSP format, which must already be checked with
+// CheckFormatBSP().  When blocks_from is given, the BLOCKMAP and REJECT
+// lumps are copied from that wad instead of being built again.
+//
+build_result_e SaveLevelBinaryFormat(level_t &level, node_t *root_node, bsp_format_t format, Wad_file *blocks_from)
+{
+  auto mark = Benchmarker(__func__);
+
+  // Note: root_node may be nullptr
+
+  cur_wad->BeginWrite();
+
+  AddMissingBinaryLumps(level);
 
   if (level.map_format == MapFormat_Doom64)
   {
-    switch (level.bsp_format)
+    switch (format)
     {
     case BSP_DeePBSPV4:
       SaveDoom64_DeePBSPV4(level, root_node);
@@ -1538,13 +1798,13 @@ build_result_e SaveLevelBinaryFormat(level_t &level, node_t *root_node)
       SaveDoom64_DoomBSP(level, root_node);
       break;
     default:
-      PrintLine(LOG_ERROR, "ERROR: Tried to write unsupported BSP format #%d on Doom64 map format", level.bsp_format);
+      PrintLine(LOG_ERROR, "ERROR: Tried to write unsupported BSP format #%d on Doom64 map format", format);
       break;
     }
   }
   else // MapFormat_Doom or MapFormat_Hexen
   {
-    switch (level.bsp_format)
+    switch (format)
     {
     case BSP_XGL3:
       SaveDoom_XGL3(level, root_node);
@@ -1567,8 +1827,15 @@ build_result_e SaveLevelBinaryFormat(level_t &level, node_t *root_node)
     }
   }
 
-  PutBlockmap(level);
-  PutReject(level);
+  if (blocks_from != nullptr)
+  {
+    CopyBlockmapAndReject(level, blocks_from);
+  }
+  else
+  {
+    PutBlockmap(level);
+    PutReject(level);
+  }
 
   cur_wad->EndWrite();
 
@@ -1585,6 +1852,8 @@ build_result_e SaveLevelBinaryFormat(level_t &level, node_t *root_node)
 
 build_result_e SaveLevelTextMap(level_t &level, node_t *root_node)
 {
+  auto mark = Benchmarker(__func__);
+
   cur_wad->BeginWrite();
 
   Lump_c *lump = CreateLevelLump(level, "ZNODES");
@@ -1608,16 +1877,152 @@ build_result_e SaveLevelTextMap(level_t &level, node_t *root_node)
   return BUILD_OK;
 }
 
+//
+// Give a wad the same BSP lumps as another one, which was saved with
+// the same format.
+//
+static build_result_e CopyLevelOutput(level_t &level, Wad_file *from, bsp_format_t format)
+{
+  auto mark = Benchmarker(__func__);
+
+  cur_wad->BeginWrite();
+
+  if (level.map_format == MapFormat_UDMF)
+  {
+    CopyLevelLump(level, from, "ZNODES");
+    AddMissingLump(level, "REJECT", "ZNODES");
+    AddMissingLump(level, "BLOCKMAP", "REJECT");
+  }
+  else
+  {
+    AddMissingBinaryLumps(level);
+
+    // vanilla formats write the vertices too
+    if (format <= BSP_DeePBSPV4)
+    {
+      CopyLevelLump(level, from, "VERTEXES");
+    }
+
+    CopyLevelLump(level, from, "SEGS");
+    CopyLevelLump(level, from, "SSECTORS");
+    CopyLevelLump(level, from, "NODES");
+    CopyLevelLump(level, from, "LEAFS");
+  }
+
+  CopyBlockmapAndReject(level, from);
+
+  cur_wad->EndWrite();
+
+  return level.overflows ? BUILD_LumpOverflow : BUILD_OK;
+}
+
+// one of the wads a level is saved into, with the BSP format it gets.
+using level_output_t = struct level_output_s
+{
+  Wad_file *wad;
+  bsp_format_t format;
+};
+
+//
+// Save the level into the wad being built, and into every extra output
+// wad, from the one BSP tree.
+//
+static build_result_e SaveLevel(level_t &level, node_t *root_node)
+{
+  std::vector<level_output_t> outputs;
+
+  outputs.push_back(level_output_t{.wad = cur_wad, .format = config.bsp_format});
+
+  for (const extra_wad_t &extra : extra_wads)
+  {
+    outputs.push_back(level_output_t{.wad = extra.wad, .format = extra.format});
+  }
+
+  if (level.map_format == MapFormat_UDMF)
+  {
+    // UDMF always gets the ZNODES lump
+    for (level_output_t &out : outputs)
+    {
+      out.format = BSP_XGL3;
+    }
+  }
+  else
+  {
+    // check for overflows...
+    CheckBinaryFormatLimits(level);
+
+    bool overflow = false;
+
+    for (level_output_t &out : outputs)
+    {
+      // If using DoomBSP format, bump to DeePBSPV4 on overflow
+      out.format = CheckFormatBSP(out.format, level, overflow);
+    }
+
+    if (overflow)
+    {
+      PrintLine(LOG_NORMAL, "WARNING: BSP overflow. Forcing DeePBSPV4 node format.");
+      config.total_warnings++;
+    }
+
+    // Using Zlib-compressed version of ZDBSP lump format
+    level.bsp_compress |= config.compress;
+  }
+
+  // saving a BSP format can remove what the next one needs: the GL
+  // formats keep the minisegs, which the others drop, and the vanilla
+  // formats round off the vertices.  Hence the formats are saved from
+  // the highest one down, and outputs sharing a format get a copy.
+  std::stable_sort(outputs.begin(), outputs.end(),
+                   [](const level_output_t &A, const level_output_t &B) { return A.format > B.format; });
+
+  Wad_file *main_wad = cur_wad;
+  const level_output_t *prev = nullptr;
+
+  build_result_e ret = BUILD_OK;
+
+  for (const level_output_t &out : outputs)
+  {
+    build_result_e res;
+
+    cur_wad = out.wad;
+
+    if (prev != nullptr && prev->format == out.format)
+    {
+      res = CopyLevelOutput(level, prev->wad, out.format);
+    }
+    else if (level.map_format == MapFormat_UDMF)
+    {
+      res = SaveLevelTextMap(level, root_node);
+    }
+    else
+    {
+      res = SaveLevelBinaryFormat(level, root_node, out.format, prev ? prev->wad : nullptr);
+    }
+
+    if (res != BUILD_OK)
+    {
+      ret = res;
+    }
+
+    prev = &out;
+  }
+
+  cur_wad = main_wad;
+
+  return ret;
+}
+
 /* ---------------------------------------------------------------- */
 
-Lump_c *CreateLevelLump(level_t &level, const char *name, size_t max_size)
+Lump_c *CreateLevelLump(level_t &level, const char *name)
 {
   // look for existing one
   Lump_c *lump = level.FindLevelLump(name);
 
   if (lump)
   {
-    cur_wad->RecreateLump(lump, max_size);
+    cur_wad->RecreateLump(lump);
   }
   else
   {
@@ -1632,7 +2037,7 @@ Lump_c *CreateLevelLump(level_t &level, const char *name, size_t max_size)
 
     cur_wad->InsertPoint(last_idx);
 
-    lump = cur_wad->AddLump(name, max_size);
+    lump = cur_wad->AddLump(name);
   }
 
   return lump;
@@ -1658,6 +2063,23 @@ void OpenWad(const char *filename)
   }
 }
 
+void OpenExtraWad(const char *filename, bsp_format_t format)
+{
+  Wad_file *wad = Wad_file::Open(filename, 'a');
+  if (wad == nullptr)
+  {
+    PrintLine(LOG_ERROR, "ERROR: Cannot open file: %s", filename);
+  }
+
+  if (wad->IsReadOnly())
+  {
+    delete wad;
+    PrintLine(LOG_ERROR, "ERROR: file is read only: %s", filename);
+  }
+
+  extra_wads.push_back(extra_wad_t{.wad = wad, .format = format});
+}
+
 void CloseWad(void)
 {
   if (cur_wad != nullptr)
@@ -1666,6 +2088,13 @@ void CloseWad(void)
     delete cur_wad;
     cur_wad = nullptr;
   }
+
+  for (extra_wad_t &extra : extra_wads)
+  {
+    delete extra.wad;
+  }
+
+  extra_wads.clear();
 }
 
 size_t LevelsInWad(void)
@@ -1695,6 +2124,9 @@ size_t ComputeBspHeight(const node_t *node)
 
 build_result_e BuildLevel(level_t &level, const char *filename)
 {
+  auto mark = Benchmarker(__func__);
+  auto span = Tracer(TraceName(level.GetLevelName()));
+
   node_t *root_node = nullptr;
   subsec_t *root_sub = nullptr;
 
@@ -1704,18 +2136,26 @@ build_result_e BuildLevel(level_t &level, const char *filename)
 
   if (level.num_real_lines > 0)
   {
+    CheckLinedefSides(level);
+
     if (config.analysis)
     {
       PrintLine(LOG_NORMAL, "[%s] Starting analysis loop for %s", __func__, level.GetLevelName());
       GenerateAnalysis(level, filename);
     }
 
-    bbox_t dummy;
-    // recursively create nodes
-    seg_t *seg_list = CreateSegs(level);
-    // recursive function T-T
-    auto mark = Benchmarker("BuildNodes");
-    BuildNodes(level, seg_list, 0, &dummy, &root_node, &root_sub, config.split_cost, config.fast, false);
+    if (config.auto_cost)
+    {
+      root_node = AutoCostBuild(level);
+    }
+    else
+    {
+      bbox_t dummy;
+      // recursively create nodes
+      seg_t *seg_list = CreateSegs(level);
+      // recursive function T-T
+      BuildNodes(level, seg_list, 0, &dummy, &root_node, &root_sub, config.split_cost, config.fast, false);
+    }
   }
 
   if (config.verbose)
@@ -1732,20 +2172,7 @@ build_result_e BuildLevel(level_t &level, const char *filename)
 
   ClockwiseBspTree(level);
 
-  build_result_t ret = BUILD_OK;
-  switch (level.map_format)
-  {
-  case MapFormat_Doom:
-  case MapFormat_Hexen:
-  case MapFormat_Doom64:
-    ret = SaveLevelBinaryFormat(level, root_node);
-    break;
-  case MapFormat_UDMF:
-    ret = SaveLevelTextMap(level, root_node);
-    break;
-  default:
-    break;
-  }
+  build_result_t ret = SaveLevel(level, root_node);
 
   FreeLevel(level);
 
@@ -25,6 +25,7 @@
 
 #include "core.hpp"
 
+#include <unordered_map>
 #include <vector>
 
 struct Lump_c;
@@ -51,11 +52,11 @@ struct quadtree_c;
 // a wall-tip is where a wall meets a vertex
 struct walltip_t
 {
-  // link in list.  List is kept in ANTI-clockwise order.
-  walltip_t *next;
-  walltip_t *prev;
+  // direction of the wall from the vertex.
+  double dx, dy;
 
-  // angle that line makes at vertex (degrees).
+  // pseudo-angle of that direction, from 0 (east) up to 4, in the
+  // same order as the real angle but without any trigonometry.
   double angle;
 
   // whether each side of wall is OPEN or CLOSED.
@@ -84,8 +85,10 @@ struct vertex_t
   // previous vertex.
   vertex_t *overlap;
 
-  // list of wall-tips
+  // array of wall-tips, kept in ANTI-clockwise order (by increasing
+  // angle).  nullptr when there are none.
   walltip_t *tip_set;
+  uint32_t num_tips;
 };
 
 // check whether a line with the given delta coordinates from this
@@ -206,9 +209,9 @@ struct seg_t
   // start and end vertices produces the same location).
   bool is_degenerate;
 
-  // the quad-tree node that contains this seg, or nullptr if the seg
-  // is now in a subsector.
-  quadtree_c *quad;
+  // the quad-tree node that contains this seg, as an index into the
+  // level's pool, or NO_QUADTREE if the seg is now in a subsector.
+  uint32_t quad;
 
   // precomputed data for faster calculations
   double psx, psy;
@@ -245,7 +248,7 @@ void Recompute(seg_t *seg);
 
 int PointOnLineSide(seg_t *seg, double x, double y);
 
-// a seg with this index is removed by SortSegs().
+// a seg with this index is freed when the BSP lumps are written.
 // it must be a very high value.
 static constexpr uint32_t SEG_IS_GARBAGE = (1 << 29);
 
@@ -266,8 +269,6 @@ struct subsec_t
   double mid_y;
 };
 
-void AddToTail(subsec_t *subsec);
-
 void DetermineMiddle(subsec_t *subsec);
 void ClockwiseOrder(subsec_t *subsec);
 void RenumberSegs(subsec_t *subsec, size_t &cur_seg_index);
@@ -313,6 +314,8 @@ struct node_t
 
 void SetPartition(node_t *node, const seg_t *part);
 
+static constexpr uint32_t NO_QUADTREE = NO_INDEX_INT32;
+
 struct quadtree_c
 {
   // NOTE: not a real quadtree, division is always binary.
@@ -323,11 +326,13 @@ struct quadtree_c
   int x1, y1;
   int x2, y2;
 
-  // sub-trees.  nullptr for leaf nodes.
+  // sub-trees, as indices into the pool.  NO_QUADTREE when missing,
+  // halves holding no segs are never created.
   // [0] has the lower coordinates, and [1] has the higher coordinates.
   // Division of a square always occurs horizontally (e.g. 512x512 ->
-  // 256x512).
-  quadtree_c *subs[2];
+  // 256x512).  Once the tree has been divided by a partition line, a
+  // child may also be smaller than its half.
+  uint32_t subs[2];
 
   // count of real/minisegs contained in this node AND ALL CHILDREN.
   size_t real_num;
@@ -337,7 +342,6 @@ struct quadtree_c
   seg_t *list;
 
   quadtree_c(int _x1, int _y1, int _x2, int _y2);
-  ~quadtree_c(void);
 
   inline bool Empty(void) const
   {
@@ -345,26 +349,71 @@ struct quadtree_c
   }
 };
 
-void AddSeg(quadtree_c *quadtree, seg_t *seg);
-void AddList(quadtree_c *quadtree, seg_t *list);
+// storage for the quadtree boxes of one level while its nodes are
+// built.  boxes are kept in a single vector and refer to each other by
+// index, freed boxes are reused by the next ones created.  Creating a
+// box may move the others, so references must not be held across it.
+struct quadtree_pool_c
+{
+  std::vector<quadtree_c> boxes;
+  std::vector<uint32_t> unused;
+
+  uint32_t New(int x1, int y1, int x2, int y2);
 
-void ConvertToList(quadtree_c *quadtree, seg_t **__list);
+  // free a single box, or a box and all of its children.
+  void Free(uint32_t index);
+  void FreeTree(uint32_t index);
+
+  // free everything, releasing the memory.
+  void Clear(void);
+
+  inline quadtree_c &operator[](uint32_t index)
+  {
+    return boxes[index];
+  }
+
+  inline const quadtree_c &operator[](uint32_t index) const
+  {
+    return boxes[index];
+  }
+};
+
+// the quadtree leaf policy of one level, with the options resolved.
+using quadtree_params_t = struct quadtree_params_s
+{
+  quadtree_policy_t policy = QUAD_Fixed;
+  int32_t leaf_size = QUAD_SIZE_DEFAULT;
+  size_t max_segs = QUAD_SEGS_DEFAULT;
+};
+
+// pick the leaf policy for a level from the options, looking at the
+// seg density for the automatic policy.
+quadtree_params_t ChooseQuadtreeParams(seg_t *list, const bbox_t *bounds);
+
+// put the segs into the quadtree, dividing boxes as the policy asks.
+void FillQuadtree(quadtree_pool_c &pool, uint32_t quadtree, seg_t *list, const quadtree_params_t &params);
+
+// add the segs to the quadtree, each one into the smallest box which
+// holds it.  no boxes are divided.
+void QuadtreeAddList(quadtree_pool_c &pool, uint32_t quadtree, seg_t *list);
+
+// drop the boxes left empty after dividing the quadtree by a partition
+// line, and boxes which only lead to a single child.  returns the new
+// top of the tree.
+uint32_t CompactQuadtree(quadtree_pool_c &pool, uint32_t quadtree, const seg_t *part);
+
+void ConvertToList(quadtree_pool_c &pool, uint32_t quadtree, seg_t **__list);
 
 // check relationship between this box and the partition line.
 // returns -1 or +1 if box is definitively on a particular side,
 // or 0 if the line intersects or touches the box.
-int OnLineSide(quadtree_c *quadtree, const seg_t *part);
+int OnLineSide(const quadtree_c *quadtree, const seg_t *part);
 
 // an "intersection" remembers the vertex that touches a BSP divider
 // line (especially a new vertex that is created at a seg split).
 
 struct intersection_t
 {
-  // link in list.  The intersection list is kept sorted by
-  // along_dist, in ascending order.
-  intersection_t *next;
-  intersection_t *prev;
-
   // vertex in question
   vertex_t *vertex;
 
@@ -383,6 +432,21 @@ struct intersection_t
   bool open_after;
 };
 
+// the intersections along one partition line.  They are collected in
+// the order they are found, then sorted by along_dist with vertices
+// which overlap merged.  The level keeps a single list, and reuses its
+// storage for every partition line.
+using cutlist_t = struct cutlist_s
+{
+  std::vector<intersection_t> cuts;
+
+  // indices into cuts, once sorted and merged.
+  std::vector<uint32_t> sorted;
+
+  // where each cut landed in the sorted order, while merging.
+  std::vector<uint32_t> position;
+};
+
 using blocklist_t = struct blocklist_t
 {
   size_t hash;
@@ -410,10 +474,10 @@ using level_t = struct level_t
   std::vector<seg_t *> segs;
   std::vector<subsec_t *> subsecs;
   std::vector<node_t *> nodes;
-  std::vector<walltip_t *> walltips;
-  std::vector<intersection_t *> intercuts;
-  bsp_format_t bsp_format = bsp_format_t::BSP_XNOD;
+  cutlist_t cut_list;
   bool bsp_compress = false;
+  quadtree_params_t quad_params;
+  quadtree_pool_c quadtrees;
 
   uint8_t *reject_matrix;
   size_t reject_size;
@@ -436,7 +500,7 @@ using level_t = struct level_t
     return (idx != NO_INDEX) ? cur_wad->GetLump(idx) : nullptr;
   }
 
-  inline const char *GetLevelName(void)
+  inline const char *GetLevelName(void) const
   {
     SYS_ASSERT(cur_wad != nullptr);
     size_t lump_idx = cur_wad->LevelHeader(level_num);
@@ -490,8 +554,6 @@ thing_t *NewThing(level_t &level);
 seg_t *NewSeg(level_t &level);
 subsec_t *NewSubsec(level_t &level);
 node_t *NewNode(level_t &level);
-walltip_t *NewWallTip(level_t &level);
-intersection_t *NewIntersection(level_t &level);
 
 void FreeVertices(level_t &level);
 void FreeSidedefs(level_t &level);
@@ -502,15 +564,82 @@ void FreeThings(level_t &level);
 void FreeSegs(level_t &level);
 void FreeSubsecs(level_t &level);
 void FreeNodes(level_t &level);
-void FreeWallTips(level_t &level);
+void FreeVertex(vertex_t *vertex);
 void FreeIntersections(level_t &level);
 
-Lump_c *CreateLevelLump(level_t &level, const char *name, size_t max_size = NO_INDEX);
+// a level view shares all the loaded map data with the original level,
+// so that several BSP trees can be built side by side.  anything the
+// build creates (segs, subsecs, nodes, new vertices, etc) is owned by
+// the view, and is freed by FreeLevelView.
+level_t CreateLevelView(const level_t &level);
+void FreeLevelView(level_t &view, const level_t &level);
+
+// move everything built in a view back into the original level.
+void AdoptLevelView(level_t &level, level_t &view);
+
+Lump_c *CreateLevelLump(level_t &level, const char *name);
 
 //------------------------------------------------------------------------
 // ANALYZE : Analyzing level structures
 //------------------------------------------------------------------------
 
+// a uniform hash grid of points, each one standing for an item (by
+// index) of the caller's choosing.  Looking for the items near a point
+// only visits the few cells around it, so matching up everything in a
+// level runs in expected linear time.
+struct point_hash_c
+{
+  double cell_size;
+
+  // first item in each cell, and the next one in the same cell for
+  // every item.  cells are keyed by their packed (x,y) coordinates.
+  std::unordered_map<uint64_t, uint32_t> heads;
+  std::vector<uint32_t> next;
+
+  explicit point_hash_c(double _cell_size, size_t reserve = 0);
+
+  void Insert(uint32_t item, double x, double y);
+
+  // call func(item) for every item in the cells touching the box of the
+  // given radius around (x,y).  The caller checks the real distance.
+  template <typename F>
+  void ForEachNear(double x, double y, double radius, const F &func) const
+  {
+    int32_t cx1 = CellCoord(x - radius);
+    int32_t cy1 = CellCoord(y - radius);
+    int32_t cx2 = CellCoord(x + radius);
+    int32_t cy2 = CellCoord(y + radius);
+
+    for (int32_t cx = cx1; cx <= cx2; cx++)
+    {
+      for (int32_t cy = cy1; cy <= cy2; cy++)
+      {
+        auto it = heads.find(CellKey(cx, cy));
+
+        if (it == heads.end())
+        {
+          continue;
+        }
+
+        for (uint32_t item = it->second; item != NO_INDEX_INT32; item = next[item])
+        {
+          func(item);
+        }
+      }
+    }
+  }
+
+  inline int32_t CellCoord(double v) const
+  {
+    return static_cast<int32_t>(floor(v / cell_size));
+  }
+
+  static inline uint64_t CellKey(int32_t cx, int32_t cy)
+  {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+  }
+};
+
 // detection routines
 void DetectOverlappingVertices(level_t &level);
 void DetectOverlappingLines(level_t &level);
@@ -551,11 +680,14 @@ static constexpr double ANG_EPSILON = (1.0 / 1024.0);
 // NODE : Recursively create nodes and return the pointers.
 //------------------------------------------------------------------------
 
+// warn once about missing or bad sidedefs, CreateSegs() is silent.
+void CheckLinedefSides(const level_t &level);
+
 // scan all the linedef of the level and convert each sidedef into a
 // seg (or seg pair).  Returns the list of segs.
 seg_t *CreateSegs(level_t &level);
 
-quadtree_c *TreeFromSegList(seg_t *list);
+uint32_t TreeFromSegList(quadtree_pool_c &pool, seg_t *list, const bbox_t *bounds, const quadtree_params_t &params);
 
 // takes the seg list and determines if it is convex.  When it is, the
 // segs are converted to a subsector, and '*S' is the new subsector
@@ -567,9 +699,45 @@ quadtree_c *TreeFromSegList(seg_t *list);
 void BuildNodes(level_t &level, seg_t *seg_list, int depth, bbox_t *bounds, node_t **N, subsec_t **S, double split_cost,
                 bool fast, bool analysis);
 
+// cheap counters for the partition search, used to judge how well the
+// quadtree pruning works.  each thread counts on its own, and adds its
+// counts to a shared total when it exits.
+using picknode_stats_t = struct picknode_stats_s
+{
+  size_t candidates = 0;    // partition candidates evaluated
+  size_t colinear = 0;      // candidates skipped, their line was tried
+  size_t pruned = 0;        // evaluations cut short by best_cost
+  size_t fast_picks = 0;    // partitions chosen by fast mode
+  size_t sampled_picks = 0; // partitions chosen from a --quality sample
+  size_t boxes_whole = 0;   // quadtree boxes resolved wholesale by OnLineSide
+  size_t segs_tested = 0;   // segs tested one at a time
+  size_t splits = 0;        // segs split by SplitSeg
+  size_t intersections = 0; // intersections created by AddIntersection
+};
+
+using picknode_counter_t = struct picknode_counter_s
+{
+  picknode_stats_t stats;
+
+  ~picknode_counter_s(void);
+};
+
+inline thread_local picknode_counter_t picknode_counter;
+
+// print the counters gathered since the last call, then reset them.
+void ReportPickNodeStats(const char *level_name);
+
 // compute the height of the bsp tree, starting at 'node'.
 size_t ComputeBspHeight(const node_t *node);
 
+// compute the statistics used by --analysis and --auto-cost.
+void ComputeAnalysis(const level_t &level, const node_t *root, AnalysisData &data);
+
+// build the level with several split costs in parallel, keeping the
+// tree which scores best under the chosen objective.  returns the
+// root node of the winning tree.
+node_t *AutoCostBuild(level_t &level);
+
 // put all the segs in each subsector into clockwise order, and renumber
 // the seg indices.
 //
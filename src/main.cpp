@@ -33,6 +33,17 @@ static bool opt_version = false;
 
 static std::string opt_output;
 
+// a copy of the input file, saved with another BSP format
+struct extra_output_t
+{
+  bsp_format_t format;
+  std::string filename;
+};
+
+static std::vector<extra_output_t> opt_extra_outputs;
+static std::string opt_profile_json;
+static std::string opt_trace;
+
 static std::vector<const char *> wad_list;
 
 static size_t total_failed_files = 0;
@@ -127,6 +138,9 @@ static void BuildFile(const char *filename)
 
     res = BuildLevel(level, filename);
 
+    ProfileReport(level.GetLevelName(), filename);
+    ReportPickNodeStats(level.GetLevelName());
+
     // handle a failed map (due to lump overflow)
     if (res == BUILD_LumpOverflow)
     {
@@ -160,7 +174,7 @@ static void BuildFile(const char *filename)
     total_failed_files += 1;
   }
 
-  PrintLine(LOG_NORMAL, "Serious warnings: %zu", config.total_warnings);
+  PrintLine(LOG_NORMAL, "Serious warnings: %zu", config.total_warnings.load());
 }
 
 void ValidateInputFilename(const char *filename)
@@ -230,6 +244,15 @@ void VisitFile(const char *filename)
     BackupFile(filename);
   }
 
+  // copy the input file for each extra output, before building
+  for (const auto &extra : opt_extra_outputs)
+  {
+    if (!FileCopy(filename, extra.filename.c_str()))
+    {
+      PrintLine(LOG_ERROR, "ERROR: failed to create output file: %s", extra.filename.c_str());
+    }
+  }
+
   if (config.analysis)
   {
     SetupAnalysisFile(filename);
@@ -240,6 +263,12 @@ void VisitFile(const char *filename)
   // this will fatal error if it fails
   OpenWad(filename);
 
+  for (const auto &extra : opt_extra_outputs)
+  {
+    PrintLine(LOG_NORMAL, "Also building %s", extra.filename.c_str());
+    OpenExtraWad(extra.filename.c_str(), extra.format);
+  }
+
   BuildFile(filename);
 
   CloseWad();
@@ -392,6 +421,9 @@ void ParseShortArgument(const char *arg)
     case 'f':
       config.fast = true;
       continue;
+    case 'q':
+      config.quality = true;
+      continue;
 
     case 'm':
     case 'o':
@@ -527,6 +559,10 @@ int32_t ParseLongArgument(const char *name, const int32_t argc, const char *argv
   {
     config.fast = true;
   }
+  else if (strcmp(name, "--quality") == 0)
+  {
+    config.quality = true;
+  }
   else if (strcmp(name, "--no-effects") == 0)
   {
     config.effects = false;
@@ -535,6 +571,23 @@ int32_t ParseLongArgument(const char *name, const int32_t argc, const char *argv
   {
     config.compress = true;
   }
+  else if (strcmp(name, "--compress-level") == 0)
+  {
+    if (argc < 1 || !isdigit(argv[0][0]))
+    {
+      PrintLine(LOG_ERROR, "ERROR: missing value for '--compress-level' option");
+    }
+
+    int32_t val = std::stoi(argv[0]);
+
+    if (val < ZLIB_LEVEL_MIN || val > ZLIB_LEVEL_MAX)
+    {
+      PrintLine(LOG_ERROR, "ERROR: illegal value for '--compress-level' option");
+    }
+
+    config.compress_level = val;
+    used = 1;
+  }
   else if (strcmp(name, "--map") == 0 || strcmp(name, "--maps") == 0)
   {
     if (argc < 1 || argv[0][0] == '-')
@@ -597,6 +650,104 @@ int32_t ParseLongArgument(const char *name, const int32_t argc, const char *argv
     config.split_cost = val;
     used = 1;
   }
+  else if (strcmp(name, "--quadtree") == 0)
+  {
+    if (argc < 1 || argv[0][0] == '-')
+    {
+      PrintLine(LOG_ERROR, "ERROR: missing value for '--quadtree' option");
+    }
+
+    if (strcmp(argv[0], "auto") == 0)
+    {
+      config.quad_policy = QUAD_Auto;
+    }
+    else if (strcmp(argv[0], "fixed") == 0)
+    {
+      config.quad_policy = QUAD_Fixed;
+    }
+    else if (strcmp(argv[0], "segs") == 0)
+    {
+      config.quad_policy = QUAD_Segs;
+    }
+    else if (strcmp(argv[0], "sah") == 0)
+    {
+      config.quad_policy = QUAD_SAH;
+    }
+    else
+    {
+      PrintLine(LOG_ERROR, "ERROR: unknown value for '--quadtree' option: '%s'", argv[0]);
+    }
+
+    used = 1;
+  }
+  else if (strcmp(name, "--quad-size") == 0)
+  {
+    if (argc < 1 || !isdigit(argv[0][0]))
+    {
+      PrintLine(LOG_ERROR, "ERROR: missing value for '--quad-size' option");
+    }
+
+    int32_t val = std::stoi(argv[0]);
+
+    if (val < 16 || val > 65536)
+    {
+      PrintLine(LOG_ERROR, "ERROR: illegal value for '--quad-size' option");
+    }
+
+    config.quad_size = val;
+    used = 1;
+  }
+  else if (strcmp(name, "--quad-segs") == 0)
+  {
+    if (argc < 1 || !isdigit(argv[0][0]))
+    {
+      PrintLine(LOG_ERROR, "ERROR: missing value for '--quad-segs' option");
+    }
+
+    int32_t val = std::stoi(argv[0]);
+
+    if (val < 1)
+    {
+      PrintLine(LOG_ERROR, "ERROR: illegal value for '--quad-segs' option");
+    }
+
+    config.quad_segs = static_cast<size_t>(val);
+    used = 1;
+  }
+  else if (strcmp(name, "--auto-cost") == 0)
+  {
+    config.auto_cost = true;
+  }
+  else if (strcmp(name, "--objective") == 0)
+  {
+    if (argc < 1 || argv[0][0] == '-')
+    {
+      PrintLine(LOG_ERROR, "ERROR: missing value for '--objective' option");
+    }
+
+    if (strcmp(argv[0], "segs") == 0)
+    {
+      config.auto_cost_objective = AUTO_COST_Segs;
+    }
+    else if (strcmp(argv[0], "nodes") == 0)
+    {
+      config.auto_cost_objective = AUTO_COST_Nodes;
+    }
+    else if (strcmp(argv[0], "depth") == 0)
+    {
+      config.auto_cost_objective = AUTO_COST_Depth;
+    }
+    else if (strcmp(argv[0], "quality") == 0)
+    {
+      config.auto_cost_objective = AUTO_COST_Quality;
+    }
+    else
+    {
+      PrintLine(LOG_ERROR, "ERROR: unknown value for '--objective' option: '%s'", argv[0]);
+    }
+
+    used = 1;
+  }
   else if (strcmp(name, "--polyobj") == 0)
   {
     config.polyobj.anchor = Hexen_PolyObj_Anchor;
@@ -621,6 +772,43 @@ int32_t ParseLongArgument(const char *name, const int32_t argc, const char *argv
     opt_output = argv[0];
     used = 1;
   }
+  else if (strcmp(name, "--extra-output") == 0)
+  {
+    if (argc < 2 || !isdigit(argv[0][0]) || argv[1][0] == '-')
+    {
+      PrintLine(LOG_ERROR, "ERROR: missing values for '--extra-output' option");
+    }
+
+    int32_t val = std::stoi(argv[0]);
+
+    if (val < BSP_MIN || val > BSP_MAX)
+    {
+      PrintLine(LOG_ERROR, "ERROR: illegal value for '--extra-output' option");
+    }
+
+    opt_extra_outputs.push_back(extra_output_t{.format = static_cast<bsp_format_t>(val), .filename = argv[1]});
+    used = 2;
+  }
+  else if (strcmp(name, "--trace") == 0)
+  {
+    if (argc < 1 || argv[0][0] == '-')
+    {
+      PrintLine(LOG_ERROR, "ERROR: missing value for '--trace' option");
+    }
+
+    opt_trace = argv[0];
+    used = 1;
+  }
+  else if (strcmp(name, "--profile-json") == 0)
+  {
+    if (argc < 1 || argv[0][0] == '-')
+    {
+      PrintLine(LOG_ERROR, "ERROR: missing value for '--profile-json' option");
+    }
+
+    opt_profile_json = argv[0];
+    used = 1;
+  }
   else if (strncmp(name, "--debug-", 8) == 0)
   {
     if (!ProcessDebugParam(name, config.debug))
@@ -757,6 +945,32 @@ int32_t main(const int32_t argc, const char *argv[])
     }
   }
 
+  if (!opt_extra_outputs.empty())
+  {
+    if (total_files > 1)
+    {
+      PrintLine(LOG_ERROR, "ERROR: cannot use multiple input files with --extra-output");
+    }
+
+    for (size_t i = 0; i < opt_extra_outputs.size(); i++)
+    {
+      const char *extra = opt_extra_outputs[i].filename.c_str();
+
+      if (StringCaseCmp(wad_list[0], extra) == 0 || StringCaseCmp(opt_output.c_str(), extra) == 0)
+      {
+        PrintLine(LOG_ERROR, "ERROR: extra output file is the same as the input or output: %s", extra);
+      }
+
+      for (size_t k = 0; k < i; k++)
+      {
+        if (StringCaseCmp(opt_extra_outputs[k].filename.c_str(), extra) == 0)
+        {
+          PrintLine(LOG_ERROR, "ERROR: extra output file given twice: %s", extra);
+        }
+      }
+    }
+  }
+
   // validate all filenames before processing any of them
   for (const auto filename : wad_list)
   {
@@ -768,11 +982,21 @@ int32_t main(const int32_t argc, const char *argv[])
     }
   }
 
+  if (!opt_trace.empty())
+  {
+    TraceStart(opt_trace.c_str());
+  }
+
   for (const auto &wad : wad_list)
   {
     VisitFile(wad);
   }
 
+  if (!opt_profile_json.empty())
+  {
+    WriteProfileJson(opt_profile_json.c_str());
+  }
+
   if (total_failed_files > 0)
   {
     PrintLine(LOG_NORMAL, "FAILURES occurred on %zu map%s in %zu file%s.", total_failed_maps, total_failed_maps == 1 ? "" : "s",
@@ -39,13 +39,31 @@ bool Overlaps(const vertex_t *vertex, const vertex_t *other)
   return (dx < DIST_EPSILON) && (dy < DIST_EPSILON);
 }
 
-struct Compare_vertex_X_pred
+// the hash cells are a lot larger than DIST_EPSILON, so looking around
+// a point usually visits one cell, and at most four.
+static constexpr double OVERLAP_CELL_SIZE = 1.0;
+
+point_hash_c::point_hash_c(double _cell_size, size_t reserve) : cell_size(_cell_size)
 {
-  inline bool operator()(const vertex_t *A, const vertex_t *B) const
+  heads.reserve(reserve);
+  next.reserve(reserve);
+}
+
+void point_hash_c::Insert(uint32_t item, double x, double y)
+{
+  if (next.size() <= item)
+  {
+    next.resize(item + 1, NO_INDEX_INT32);
+  }
+
+  auto [it, fresh] = heads.try_emplace(CellKey(CellCoord(x), CellCoord(y)), item);
+
+  if (!fresh)
   {
-    return A->x < B->x;
+    next[item] = it->second;
+    it->second = item;
   }
-};
+}
 
 void DetectOverlappingVertices(level_t &level)
 {
@@ -54,37 +72,38 @@ void DetectOverlappingVertices(level_t &level)
     return;
   }
 
-  // copy the vertex pointers
-  std::vector<vertex_t *> array(level.vertices);
-
-  // sort the vertices by increasing X coordinate.
-  // hence any overlapping vertices will be near each other.
-  std::sort(array.begin(), array.end(), Compare_vertex_X_pred());
+  // only vertices which overlap nothing before them go into the hash,
+  // every later one overlapping them is merged into the lowest numbered.
+  point_hash_c hash(OVERLAP_CELL_SIZE, level.vertices.size());
 
-  // now mark them off
-  for (size_t i = 0; i < level.vertices.size() - 1; i++)
+  for (size_t i = 0; i < level.vertices.size(); i++)
   {
-    vertex_t *A = array[i];
+    vertex_t *V = level.vertices[i];
+    vertex_t *first = nullptr;
 
-    for (size_t k = i + 1; k < level.vertices.size(); k++)
-    {
-      vertex_t *B = array[k];
+    hash.ForEachNear(V->x, V->y, DIST_EPSILON,
+                     [&](uint32_t k)
+                     {
+                       vertex_t *other = level.vertices[k];
 
-      if (B->x > A->x + DIST_EPSILON)
-      {
-        break;
-      }
+                       if (Overlaps(V, other) && (first == nullptr || other->index < first->index))
+                       {
+                         first = other;
+                       }
+                     });
 
-      if (Overlaps(A, B))
-      {
-        // found an overlap !
-        B->overlap = A->overlap ? A->overlap : A;
+    if (first == nullptr)
+    {
+      hash.Insert(static_cast<uint32_t>(i), V->x, V->y);
+      continue;
+    }
 
-        if (HAS_BIT(config.debug, DEBUG_OVERLAPS))
-        {
-          PrintLine(LOG_DEBUG, "[%s] Overlap: #%zu + #%zu", __func__, array[i]->index, array[i + 1]->index);
-        }
-      }
+    // found an overlap !
+    V->overlap = first;
+
+    if (HAS_BIT(config.debug, DEBUG_OVERLAPS))
+    {
+      PrintLine(LOG_DEBUG, "[%s] Overlap: #%zu + #%zu", __func__, first->index, V->index);
     }
   }
 
@@ -118,7 +137,7 @@ void ClearNewVertices(level_t &level)
       break;
     }
 
-    UtilFree(V);
+    FreeVertex(V);
 
     level.vertices.pop_back();
   }
@@ -143,7 +162,7 @@ void PruneVerticesAtEnd(level_t &level)
       break;
     }
 
-    UtilFree(V);
+    FreeVertex(V);
 
     level.vertices.pop_back();
   }
@@ -158,62 +177,50 @@ void PruneVerticesAtEnd(level_t &level)
   level.num_old_vert = level.vertices.size();
 }
 
-struct Compare_line_MinX_pred
-{
-  inline bool operator()(const linedef_t *A, const linedef_t *B) const
-  {
-    return A->MinX() < B->MinX();
-  }
-};
-
 void DetectOverlappingLines(level_t &level)
 {
   // Algorithm:
-  //   Sort all lines by minimum X coordinate.
-  //   Overlapping lines will then be near each other in this set.
+  //   Hash all lines by their middle point, lines with the same two
+  //   vertices will then be found in the same cell.
   //   NOTE: does not detect partially overlapping lines.
 
-  std::vector<linedef_t *> array(level.linedefs);
-
-  std::sort(array.begin(), array.end(), Compare_line_MinX_pred());
+  point_hash_c hash(OVERLAP_CELL_SIZE, level.linedefs.size());
 
   size_t count = 0;
 
-  for (size_t i = 0; i < level.linedefs.size() - 1; i++)
+  for (size_t i = 0; i < level.linedefs.size(); i++)
   {
-    linedef_t *A = array[i];
-
-    for (size_t k = i + 1; k < level.linedefs.size(); k++)
-    {
-      linedef_t *B = array[k];
-
-      if (B->MinX() > A->MinX() + DIST_EPSILON)
-      {
-        break;
-      }
-
-      // due to DetectOverlappingVertices(), we can compare the vertex
-      // pointers
-      bool over1 = (A->start == B->start) && (A->end == B->end);
-      bool over2 = (A->start == B->end) && (A->end == B->start);
-
-      if (over1 || over2)
-      {
-        // found an overlap !
-
-        // keep the lowest numbered one
-        if (A->index < B->index)
-        {
-          A->overlap = B->overlap ? B->overlap : B;
-        }
-        else
-        {
-          B->overlap = A->overlap ? A->overlap : A;
-        }
-
-        count++;
-      }
-    }
+    linedef_t *B = level.linedefs[i];
+
+    double mid_x = (B->start->x + B->end->x) * 0.5;
+    double mid_y = (B->start->y + B->end->y) * 0.5;
+
+    hash.ForEachNear(mid_x, mid_y, DIST_EPSILON,
+                     [&](uint32_t k)
+                     {
+                       linedef_t *A = level.linedefs[k];
+
+                       if (A->overlap != nullptr)
+                       {
+                         return;
+                       }
+
+                       // due to DetectOverlappingVertices(), we can compare
+                       // the vertex pointers
+                       bool over1 = (A->start == B->start) && (A->end == B->end);
+                       bool over2 = (A->start == B->end) && (A->end == B->start);
+
+                       if (over1 || over2)
+                       {
+                         // found an overlap !  like before, the earlier
+                         // line is the one marked, and no segs are made
+                         // for it.
+                         A->overlap = B;
+                         count++;
+                       }
+                     });
+
+    hash.Insert(static_cast<uint32_t>(i), mid_x, mid_y);
   }
 
   if (count > 0)
@@ -227,49 +234,51 @@ void DetectOverlappingLines(level_t &level)
 
 /* ----- vertex routines ------------------------------- */
 
-void AddWallTip(level_t &level, vertex_t *vertex, double dx, double dy, bool open_left, bool open_right)
+// whether the direction runs along the wall-tip, i.e. the angle between
+// them is under ANG_EPSILON degrees.  The cross product of the two gives
+// the sine of that angle, and for such tiny angles the two are equal.
+static bool WallTipAlong(const walltip_t *tip, double dx, double dy)
 {
-  SYS_ASSERT(vertex->overlap == nullptr);
+  constexpr double max_sin = ANG_EPSILON * M_PI / 180.0;
 
-  walltip_t *tip = NewWallTip(level);
-  walltip_t *after;
+  double cross = tip->dx * dy - tip->dy * dx;
+  double dot = tip->dx * dx + tip->dy * dy;
 
-  tip->angle = ComputeAngle(dx, dy);
-  tip->open_left = open_left;
-  tip->open_right = open_right;
+  return dot > 0 && fabs(cross) < max_sin * hypot(tip->dx, tip->dy) * hypot(dx, dy);
+}
 
-  // find the correct place (order is increasing angle)
-  for (after = vertex->tip_set; after && after->next; after = after->next)
-  {
-  }
+// index of the first wall-tip with a greater angle, or num_tips.
+static uint32_t WallTipAfter(const vertex_t *vertex, double angle)
+{
+  const walltip_t *begin = vertex->tip_set;
+  const walltip_t *end = begin + vertex->num_tips;
+  const walltip_t *tip = std::upper_bound(begin, end, angle, [](double A, const walltip_t &B) { return A < B.angle; });
 
-  while (after && tip->angle + ANG_EPSILON < after->angle)
-  {
-    after = after->prev;
-  }
+  return static_cast<uint32_t>(tip - begin);
+}
 
-  // link it in
-  tip->next = after ? after->next : vertex->tip_set;
-  tip->prev = after;
+void AddWallTip(vertex_t *vertex, double dx, double dy, bool open_left, bool open_right)
+{
+  SYS_ASSERT(vertex->overlap == nullptr);
 
-  if (after)
-  {
-    if (after->next)
-    {
-      after->next->prev = tip;
-    }
+  walltip_t tip;
 
-    after->next = tip;
-  }
-  else
-  {
-    if (vertex->tip_set != nullptr)
-    {
-      vertex->tip_set->prev = tip;
-    }
+  tip.dx = dx;
+  tip.dy = dy;
+  tip.angle = ComputePseudoAngle(dx, dy);
+  tip.open_left = open_left;
+  tip.open_right = open_right;
 
-    vertex->tip_set = tip;
-  }
+  // find the correct place (order is increasing angle), after any
+  // wall-tips at the same angle
+  uint32_t pos = WallTipAfter(vertex, tip.angle);
+
+  vertex->tip_set = UtilRealloc(vertex->tip_set, (vertex->num_tips + 1) * sizeof(walltip_t));
+
+  std::copy_backward(vertex->tip_set + pos, vertex->tip_set + vertex->num_tips, vertex->tip_set + vertex->num_tips + 1);
+
+  vertex->tip_set[pos] = tip;
+  vertex->num_tips++;
 }
 
 void CalculateWallTips(level_t &level)
@@ -294,8 +303,8 @@ void CalculateWallTips(level_t &level)
     // note that start->overlap and end->overlap should be nullptr
     // due to logic in DetectOverlappingVertices.
 
-    AddWallTip(level, L->start, x2 - x1, y2 - y1, left, right);
-    AddWallTip(level, L->end, x1 - x2, y1 - y2, right, left);
+    AddWallTip(L->start, x2 - x1, y2 - y1, left, right);
+    AddWallTip(L->end, x1 - x2, y1 - y2, right, left);
   }
 
   if (HAS_BIT(config.debug, DEBUG_WALLTIPS))
@@ -306,9 +315,12 @@ void CalculateWallTips(level_t &level)
 
       PrintLine(LOG_DEBUG, "[%s] WallTips for vertex %zu:", __func__, k);
 
-      for (walltip_t *tip = V->tip_set; tip; tip = tip->next)
+      for (uint32_t t = 0; t < V->num_tips; t++)
       {
-        PrintLine(LOG_DEBUG, "Angle=%1.1f left=%d right=%d", tip->angle, tip->open_left ? 1 : 0, tip->open_right ? 1 : 0);
+        const walltip_t *tip = &V->tip_set[t];
+
+        PrintLine(LOG_DEBUG, "Angle=%1.1f left=%d right=%d", ComputeAngle(tip->dx, tip->dy), tip->open_left ? 1 : 0,
+                  tip->open_right ? 1 : 0);
       }
     }
   }
@@ -330,8 +342,8 @@ vertex_t *NewVertexFromSplitSeg(level_t &level, seg_t *seg, double x, double y)
   // compute wall-tip info
   if (seg->linedef == nullptr)
   {
-    AddWallTip(level, vert, seg->pdx, seg->pdy, true, true);
-    AddWallTip(level, vert, -seg->pdx, -seg->pdy, true, true);
+    AddWallTip(vert, seg->pdx, seg->pdy, true, true);
+    AddWallTip(vert, -seg->pdx, -seg->pdy, true, true);
   }
   else
   {
@@ -341,8 +353,8 @@ vertex_t *NewVertexFromSplitSeg(level_t &level, seg_t *seg, double x, double y)
     bool left = (back != nullptr) && (back->sector != nullptr);
     bool right = (front != nullptr) && (front->sector != nullptr);
 
-    AddWallTip(level, vert, seg->pdx, seg->pdy, left, right);
-    AddWallTip(level, vert, -seg->pdx, -seg->pdy, right, left);
+    AddWallTip(vert, seg->pdx, seg->pdy, left, right);
+    AddWallTip(vert, -seg->pdx, -seg->pdy, right, left);
   }
 
   return vert;
@@ -389,44 +401,36 @@ vertex_t *NewVertexDegenerate(level_t &level, vertex_t *start, vertex_t *end)
 
 bool CheckOpen(const vertex_t *vertex, double dx, double dy)
 {
-  const walltip_t *tip;
+  uint32_t count = vertex->num_tips;
 
-  double angle = ComputeAngle(dx, dy);
+  // usually won't happen
+  if (count == 0)
+  {
+    return true;
+  }
+
+  // find the first wall-tip whose angle is greater than the angle we're
+  // interested in.  Therefore we'll be on the RIGHT side of that
+  // wall-tip, or on the LEFT side of the one with the largest angle
+  // when there is none.
+  uint32_t after = WallTipAfter(vertex, ComputePseudoAngle(dx, dy));
+
+  const walltip_t *next = &vertex->tip_set[after % count];
+  const walltip_t *prev = &vertex->tip_set[(after + count - 1) % count];
 
   // first check whether there's a wall-tip that lies in the exact
   // direction of the given direction (which is relative to the
-  // vertex).
-
-  for (tip = vertex->tip_set; tip; tip = tip->next)
+  // vertex).  Only the neighbours on either side can be that close.
+  if (WallTipAlong(next, dx, dy) || WallTipAlong(prev, dx, dy))
   {
-    if (fabs(tip->angle - angle) < ANG_EPSILON || fabs(tip->angle - angle) > (360.0 - ANG_EPSILON))
-    {
-      // found one, hence closed
-      return false;
-    }
+    // found one, hence closed
+    return false;
   }
 
-  // OK, now just find the first wall-tip whose angle is greater than
-  // the angle we're interested in.  Therefore we'll be on the RIGHT
-  // side of that wall-tip.
-
-  for (tip = vertex->tip_set; tip; tip = tip->next)
+  if (after == count)
   {
-    if (angle + ANG_EPSILON < tip->angle)
-    {
-      // found it
-      return tip->open_right;
-    }
-
-    if (!tip->next)
-    {
-      // no more tips, thus we must be on the LEFT side of the tip
-      // with the largest angle.
-
-      return tip->open_left;
-    }
+    return prev->open_left;
   }
 
-  // usually won't get here
-  return true;
+  return next->open_right;
 }
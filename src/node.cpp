@@ -21,6 +21,9 @@
 //
 //------------------------------------------------------------------------------
 
+#include <mutex>
+#include <unordered_map>
+
 #include "core.hpp"
 #include "local.hpp"
 
@@ -45,6 +48,23 @@
 static constexpr uint32_t PRECIOUS_MULTIPLY = 100;
 static constexpr uint32_t SEG_FAST_THRESHOLD = 200;
 
+// below this many real segs, --quality tries every seg as a partition.
+// above it, only a few segs picked at random from each quadtree box.
+static constexpr uint32_t SEG_SAMPLE_THRESHOLD = 64;
+static constexpr size_t SAMPLE_PER_BOX = 8;
+
+// smallest box the seg-count and SAH quadtree policies will divide
+static constexpr int32_t QUAD_MIN_SIZE = 64;
+
+// cost of testing a quadtree box against a partition, in seg tests.
+// includes the recursion, measured on the synthetic test maps.
+static constexpr double QUAD_BOX_COST = 8.0;
+
+// the automatic policy stops dividing boxes which would hold about this
+// many segs at the average seg density of the map
+static constexpr double QUAD_AUTO_MIN_SEGS = 8.0;
+static constexpr int32_t QUAD_AUTO_MAX_SIZE = 512;
+
 struct eval_info_t
 {
   double cost;
@@ -132,6 +152,8 @@ seg_t *SplitSeg(level_t &level, seg_t *old_seg, double x, double y)
     }
   }
 
+  picknode_counter.stats.splits++;
+
   vertex_t *new_vert = NewVertexFromSplitSeg(level, old_seg, x, y);
   seg_t *new_seg = NewSeg(level);
 
@@ -227,74 +249,130 @@ inline void ComputeIntersection(seg_t *seg, seg_t *part, double perp_c, double p
   }
 }
 
-void AddIntersection(level_t &level, intersection_t **cut_list, vertex_t *vert, seg_t *part, bool self_ref)
+void AddIntersection(cutlist_t *cut_list, vertex_t *vert, seg_t *part, bool self_ref)
 {
-  bool open_before = CheckOpen(vert, -part->pdx, -part->pdy);
-  bool open_after = CheckOpen(vert, part->pdx, part->pdy);
+  intersection_t cut;
+
+  cut.vertex = vert;
+  cut.along_dist = part->ParallelDist(vert->x, vert->y);
+  cut.self_ref = self_ref;
+  cut.open_before = CheckOpen(vert, -part->pdx, -part->pdy);
+  cut.open_after = CheckOpen(vert, part->pdx, part->pdy);
+
+  // merging and sorting happens once all have been found
+  cut_list->cuts.push_back(cut);
+}
+
+// marks a cut in cutlist_t::position which was merged away
+static constexpr uint32_t CUT_MERGED = UINT32_MAX;
 
-  double along_dist = part->ParallelDist(vert->x, vert->y);
+//
+// Checks the cut against every one found before it and still kept,
+// they are within DIST_EPSILON on both axes so only a short run of
+// the sorted list on either side needs checking.
+//
+static bool OverlapsEarlierCut(const cutlist_t *cut_list, uint32_t index)
+{
+  const std::vector<intersection_t> &cuts = cut_list->cuts;
+  const std::vector<uint32_t> &order = cut_list->sorted;
+  const std::vector<uint32_t> &position = cut_list->position;
 
-  intersection_t *cut;
-  intersection_t *after;
+  const intersection_t &cut = cuts[index];
 
-  /* merge with any existing vertex? */
-  for (cut = (*cut_list); cut; cut = cut->next)
+  for (size_t k = position[index]; k > 0; k--)
   {
-    if (Overlaps(vert, cut->vertex))
+    uint32_t other = order[k - 1];
+
+    if (cut.along_dist - cuts[other].along_dist > 2.0 * DIST_EPSILON)
     {
-      return;
+      break;
+    }
+
+    if (other < index && position[other] != CUT_MERGED && Overlaps(cut.vertex, cuts[other].vertex))
+    {
+      return true;
+    }
+  }
+
+  for (size_t k = position[index] + 1; k < order.size(); k++)
+  {
+    uint32_t other = order[k];
+
+    if (cuts[other].along_dist - cut.along_dist > 2.0 * DIST_EPSILON)
+    {
+      break;
+    }
+
+    if (other < index && position[other] != CUT_MERGED && Overlaps(cut.vertex, cuts[other].vertex))
+    {
+      return true;
     }
   }
 
-  /* create new intersection */
-  cut = NewIntersection(level);
+  return false;
+}
 
-  cut->vertex = vert;
-  cut->along_dist = along_dist;
-  cut->self_ref = self_ref;
-  cut->open_before = open_before;
-  cut->open_after = open_after;
+//
+// Sort the intersections by along_dist, and merge the ones whose
+// vertices overlap.  Like the old linked list, they are visited in
+// the order found and each one is dropped when it overlaps one which
+// was kept before it.
+//
+void SortIntersections(cutlist_t *cut_list)
+{
+  const std::vector<intersection_t> &cuts = cut_list->cuts;
+  std::vector<uint32_t> &order = cut_list->sorted;
+  std::vector<uint32_t> &position = cut_list->position;
 
-  /* insert the new intersection into the list */
+  order.clear();
 
-  for (after = (*cut_list); after && after->next; after = after->next)
+  for (uint32_t i = 0; i < cuts.size(); i++)
   {
+    order.push_back(i);
   }
 
-  while (after && cut->along_dist < after->along_dist)
+  // a stable sort keeps the order they were found for equal distances
+  std::stable_sort(order.begin(), order.end(),
+                   [&cuts](uint32_t A, uint32_t B) { return cuts[A].along_dist < cuts[B].along_dist; });
+
+  position.resize(cuts.size());
+
+  for (uint32_t k = 0; k < order.size(); k++)
   {
-    after = after->prev;
+    position[order[k]] = k;
   }
 
-  /* link it in */
-  cut->next = after ? after->next : (*cut_list);
-  cut->prev = after;
-
-  if (after)
+  for (uint32_t i = 0; i < cuts.size(); i++)
   {
-    if (after->next)
+    if (OverlapsEarlierCut(cut_list, i))
     {
-      after->next->prev = cut;
+      position[i] = CUT_MERGED;
     }
-
-    after->next = cut;
   }
-  else
+
+  size_t kept = 0;
+
+  for (size_t k = 0; k < order.size(); k++)
   {
-    if (*cut_list)
+    if (position[order[k]] != CUT_MERGED)
     {
-      (*cut_list)->prev = cut;
+      order[kept++] = order[k];
     }
-
-    (*cut_list) = cut;
   }
+
+  order.resize(kept);
+
+  picknode_counter.stats.intersections += kept;
 }
 
 //
 // Returns true if a "bad seg" was found early.
 //
-bool EvalPartitionWorker(quadtree_c *tree, seg_t *part, double best_cost, double split_cost, eval_info_t *info)
+bool EvalPartitionWorker(const quadtree_pool_c &pool, uint32_t index, seg_t *part, double best_cost, double split_cost,
+                         eval_info_t *info)
 {
+  const quadtree_c *tree = &pool[index];
+
   // -AJA- this is the heart of the superblock idea, it tests the
   //       *whole* quad against the partition line to quickly handle
   //       all the segs within it at once.  Only when the partition
@@ -308,6 +386,7 @@ bool EvalPartitionWorker(quadtree_c *tree, seg_t *part, double best_cost, double
     info->real_left += tree->real_num;
     info->mini_left += tree->mini_num;
 
+    picknode_counter.stats.boxes_whole++;
     return false;
   }
   else if (side > 0)
@@ -316,6 +395,7 @@ bool EvalPartitionWorker(quadtree_c *tree, seg_t *part, double best_cost, double
     info->real_right += tree->real_num;
     info->mini_right += tree->mini_num;
 
+    picknode_counter.stats.boxes_whole++;
     return false;
   }
 
@@ -329,6 +409,8 @@ bool EvalPartitionWorker(quadtree_c *tree, seg_t *part, double best_cost, double
       return true;
     }
 
+    picknode_counter.stats.segs_tested++;
+
     double qnty;
 
     double a = 0, fa = 0;
@@ -470,9 +552,9 @@ bool EvalPartitionWorker(quadtree_c *tree, seg_t *part, double best_cost, double
       return true;
     }
 
-    if (tree->subs[c] != nullptr && !tree->subs[c]->Empty())
+    if (tree->subs[c] != NO_QUADTREE && !pool[tree->subs[c]].Empty())
     {
-      if (EvalPartitionWorker(tree->subs[c], part, best_cost, split_cost, info))
+      if (EvalPartitionWorker(pool, tree->subs[c], part, best_cost, split_cost, info))
       {
         return true;
       }
@@ -491,8 +573,10 @@ bool EvalPartitionWorker(quadtree_c *tree, seg_t *part, double best_cost, double
 // Returns the computed cost, or a negative value if the seg should be
 // skipped altogether.
 //
-double EvalPartition(quadtree_c *tree, seg_t *part, double best_cost, double split_cost)
+double EvalPartition(const quadtree_pool_c &pool, uint32_t tree, seg_t *part, double best_cost, double split_cost)
 {
+  auto mark = Benchmarker(__func__);
+
   eval_info_t info;
 
   /* initialise info structure */
@@ -506,8 +590,11 @@ double EvalPartition(quadtree_c *tree, seg_t *part, double best_cost, double spl
   info.mini_left = 0;
   info.mini_right = 0;
 
-  if (EvalPartitionWorker(tree, part, best_cost, split_cost, &info))
+  picknode_counter.stats.candidates++;
+
+  if (EvalPartitionWorker(pool, tree, part, best_cost, split_cost, &info))
   {
+    picknode_counter.stats.pruned++;
     return -1.0;
   }
 
@@ -548,8 +635,10 @@ double EvalPartition(quadtree_c *tree, seg_t *part, double best_cost, double spl
   return info.cost;
 }
 
-void EvaluateFastWorker(quadtree_c *tree, seg_t **best_H, seg_t **best_V, int mid_x, int mid_y)
+void EvaluateFastWorker(const quadtree_pool_c &pool, uint32_t index, seg_t **best_H, seg_t **best_V, int mid_x, int mid_y)
 {
+  const quadtree_c *tree = &pool[index];
+
   for (seg_t *part = tree->list; part; part = part->next)
   {
     /* ignore minisegs as partition candidates */
@@ -599,34 +688,38 @@ void EvaluateFastWorker(quadtree_c *tree, seg_t **best_H, seg_t **best_V, int mi
   /* handle sub-blocks recursively */
   for (int c = 0; c < 2; c++)
   {
-    if (tree->subs[c] != nullptr && !tree->subs[c]->Empty())
+    if (tree->subs[c] != NO_QUADTREE && !pool[tree->subs[c]].Empty())
     {
-      EvaluateFastWorker(tree->subs[c], best_H, best_V, mid_x, mid_y);
+      EvaluateFastWorker(pool, tree->subs[c], best_H, best_V, mid_x, mid_y);
     }
   }
 }
 
-seg_t *FindFastSeg(quadtree_c *tree, double split_cost)
+//
+// The middle comes from the bounds of the segs, not the quadtree box,
+// which is often the larger box of a parent once split in place.
+//
+seg_t *FindFastSeg(const quadtree_pool_c &pool, uint32_t tree, const bbox_t *bounds, double split_cost)
 {
   seg_t *best_H = nullptr;
   seg_t *best_V = nullptr;
 
-  int mid_x = (tree->x1 + tree->x2) / 2;
-  int mid_y = (tree->y1 + tree->y2) / 2;
+  int mid_x = (bounds->minx + bounds->maxx) / 2;
+  int mid_y = (bounds->miny + bounds->maxy) / 2;
 
-  EvaluateFastWorker(tree, &best_H, &best_V, mid_x, mid_y);
+  EvaluateFastWorker(pool, tree, &best_H, &best_V, mid_x, mid_y);
 
   double H_cost = -1.0;
   double V_cost = -1.0;
 
   if (best_H)
   {
-    H_cost = EvalPartition(tree, best_H, 1.0e99, split_cost);
+    H_cost = EvalPartition(pool, tree, best_H, 1.0e99, split_cost);
   }
 
   if (best_V)
   {
-    V_cost = EvalPartition(tree, best_V, 1.0e99, split_cost);
+    V_cost = EvalPartition(pool, tree, best_V, 1.0e99, split_cost);
   }
 
   if (HAS_BIT(config.debug, DEBUG_PICKNODE))
@@ -651,10 +744,66 @@ seg_t *FindFastSeg(quadtree_c *tree, double split_cost)
   return (V_cost < H_cost) ? best_V : best_H;
 }
 
-static void PickNodeWorker(quadtree_c *part_list, quadtree_c *tree, seg_t **best, double *best_cost, double split_cost)
+//
+// The lines already tried as a partition by one PickNode call.  Segs
+// along the same line (pieces of a split linedef, or linedefs in a row
+// along a wall) give the same cost, so only the first one found is
+// tried, which is also the one a full search would keep on a tie.
+//
+// Lines are looked up by their direction and distance from the origin,
+// rounded off, then checked properly against the seg stored there.
+// Lines which round off differently are simply tried again.
+//
+using partition_lines_t = std::unordered_map<uint64_t, const seg_t *>;
+
+static uint64_t PartitionLineKey(const seg_t *part)
+{
+  double ux = part->pdx / part->p_length;
+  double uy = part->pdy / part->p_length;
+
+  // both directions along a line are the same line
+  if (ux < 0 || (ux == 0 && uy < 0))
+  {
+    ux = -ux;
+    uy = -uy;
+  }
+
+  double dist = part->psx * uy - part->psy * ux;
+
+  auto qx = static_cast<uint64_t>(llround(ux * 65536.0));
+  auto qy = static_cast<uint64_t>(llround(uy * 65536.0));
+  auto qd = static_cast<uint64_t>(llround(dist * 64.0));
+
+  return (qd * 0x9E3779B97F4A7C15) ^ (qx << 40) ^ (qy << 20) ^ qy;
+}
+
+// true when a seg along the same line was already tried, otherwise the
+// line is remembered.
+static bool PartitionLineSeen(partition_lines_t &lines, const seg_t *part)
+{
+  auto [it, added] = lines.try_emplace(PartitionLineKey(part), part);
+
+  if (added)
+  {
+    return false;
+  }
+
+  const seg_t *other = it->second;
+
+  if (fabs(other->PerpDist(part->psx, part->psy)) > DIST_EPSILON || fabs(other->PerpDist(part->pex, part->pey)) > DIST_EPSILON)
+  {
+    return false;
+  }
+
+  picknode_counter.stats.colinear++;
+  return true;
+}
+
+static void PickNodeWorker(const quadtree_pool_c &pool, uint32_t part_list, uint32_t tree, seg_t **best, double *best_cost,
+                           double split_cost, partition_lines_t &lines)
 {
   /* try each Seg as partition */
-  for (seg_t *part = part_list->list; part; part = part->next)
+  for (seg_t *part = pool[part_list].list; part; part = part->next)
   {
     if (HAS_BIT(config.debug, DEBUG_PICKNODE))
     {
@@ -668,7 +817,110 @@ static void PickNodeWorker(quadtree_c *part_list, quadtree_c *tree, seg_t **best
       continue;
     }
 
-    double cost = EvalPartition(tree, part, *best_cost, split_cost);
+    if (PartitionLineSeen(lines, part))
+    {
+      continue;
+    }
+
+    double cost = EvalPartition(pool, tree, part, *best_cost, split_cost);
+
+    /* seg unsuitable or too costly ? */
+    if (cost < 0 || cost >= *best_cost)
+    {
+      continue;
+    }
+
+    /* we have a new better choice */
+    (*best_cost) = cost;
+
+    /* remember which Seg */
+    (*best) = part;
+  }
+
+  /* recursively handle sub-blocks */
+  for (int c = 0; c < 2; c++)
+  {
+    uint32_t sub = pool[part_list].subs[c];
+
+    if (sub != NO_QUADTREE && !pool[sub].Empty())
+    {
+      PickNodeWorker(pool, sub, tree, best, best_cost, split_cost, lines);
+    }
+  }
+}
+
+// a small generator (splitmix64) for picking the sampled partition
+// candidates, always seeded the same way for the same segs.
+static uint64_t SampleNext(uint64_t *state)
+{
+  *state += 0x9E3779B97F4A7C15;
+
+  uint64_t z = *state;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+
+  return z ^ (z >> 31);
+}
+
+//
+// Like PickNodeWorker, but only tries up to SAMPLE_PER_BOX segs of each
+// box.  The real segs of the box are cut into that many equal runs, and
+// one seg is picked at random in each run, so the candidates are spread
+// over the whole box.
+//
+static void PickNodeSampledWorker(const quadtree_pool_c &pool, uint32_t part_list, uint32_t tree, seg_t **best,
+                                  double *best_cost, double split_cost, uint64_t *seed, partition_lines_t &lines)
+{
+  size_t count = 0;
+
+  for (const seg_t *part = pool[part_list].list; part; part = part->next)
+  {
+    if (part->linedef != nullptr)
+    {
+      count++;
+    }
+  }
+
+  size_t runs = std::min(count, SAMPLE_PER_BOX);
+  size_t run = 0;
+  size_t index = 0;
+  size_t pick = 0;
+
+  if (runs > 0)
+  {
+    pick = SampleNext(seed) % (count / runs);
+  }
+
+  for (seg_t *part = pool[part_list].list; part && run < runs; part = part->next)
+  {
+    /* ignore minisegs as partition candidates */
+    if (part->linedef == nullptr)
+    {
+      continue;
+    }
+
+    if (index++ != pick)
+    {
+      continue;
+    }
+
+    // next run goes from (run * count / runs) up to the following one
+    run++;
+
+    if (run < runs)
+    {
+      size_t lo = run * count / runs;
+      size_t hi = (run + 1) * count / runs;
+
+      pick = lo + SampleNext(seed) % (hi - lo);
+    }
+
+    if (PartitionLineSeen(lines, part))
+    {
+      continue;
+    }
+
+    double cost = EvalPartition(pool, tree, part, *best_cost, split_cost);
 
     /* seg unsuitable or too costly ? */
     if (cost < 0 || cost >= *best_cost)
@@ -686,9 +938,11 @@ static void PickNodeWorker(quadtree_c *part_list, quadtree_c *tree, seg_t **best
   /* recursively handle sub-blocks */
   for (int c = 0; c < 2; c++)
   {
-    if (part_list->subs[c] != nullptr && !part_list->subs[c]->Empty())
+    uint32_t sub = pool[part_list].subs[c];
+
+    if (sub != NO_QUADTREE && !pool[sub].Empty())
     {
-      PickNodeWorker(part_list->subs[c], tree, best, best_cost, split_cost);
+      PickNodeSampledWorker(pool, sub, tree, best, best_cost, split_cost, seed, lines);
     }
   }
 }
@@ -699,9 +953,11 @@ static void PickNodeWorker(quadtree_c *part_list, quadtree_c *tree, seg_t **best
 // scan all the segs in the list, and choose the best seg to use as a
 // partition line, returning it.  If no seg can be used, returns nullptr.
 // The 'depth' parameter is the current depth in the tree, used for
-// computing the current progress.
-seg_t *PickNode(quadtree_c *tree, int depth, double split_cost, bool fast)
+// computing the current progress, and 'bounds' are those of its segs.
+seg_t *PickNode(const quadtree_pool_c &pool, uint32_t tree, const bbox_t *bounds, int depth, double split_cost, bool fast)
 {
+  auto mark = Benchmarker(__func__);
+
   seg_t *best = nullptr;
 
   double best_cost = 1.0e99;
@@ -715,17 +971,19 @@ seg_t *PickNode(quadtree_c *tree, int depth, double split_cost, bool fast)
    *       are axis-aligned and roughly divide the current group into
    *       two halves.  This can save *heaps* of times on large levels.
    */
-  if (fast && tree->real_num >= SEG_FAST_THRESHOLD)
+  if (fast && pool[tree].real_num >= SEG_FAST_THRESHOLD)
   {
     if (HAS_BIT(config.debug, DEBUG_PICKNODE))
     {
       PrintLine(LOG_DEBUG, "[%s] Looking for Fast node...", __func__);
     }
 
-    best = FindFastSeg(tree, split_cost);
+    best = FindFastSeg(pool, tree, bounds, split_cost);
 
     if (best != nullptr)
     {
+      picknode_counter.stats.fast_picks++;
+
       if (HAS_BIT(config.debug, DEBUG_PICKNODE))
       {
         PrintLine(LOG_DEBUG, "[%s] Using Fast node (%1.1f,%1.1f) -> (%1.1f,%1.1f)", __func__, best->start->x, best->start->y,
@@ -735,7 +993,30 @@ seg_t *PickNode(quadtree_c *tree, int depth, double split_cost, bool fast)
     }
   }
 
-  PickNodeWorker(tree, tree, &best, &best_cost, split_cost);
+  partition_lines_t lines;
+
+  // the --quality tier: only try a sample of the segs of large groups,
+  // falling back to trying every seg when none of them was usable.
+  if (config.quality && pool[tree].real_num >= SEG_SAMPLE_THRESHOLD)
+  {
+    const quadtree_c *box = &pool[tree];
+
+    uint64_t seed = (static_cast<uint64_t>(static_cast<uint32_t>(box->x1)) << 32) ^ static_cast<uint32_t>(box->y1);
+    seed ^= (static_cast<uint64_t>(box->real_num) << 20) ^ box->mini_num;
+
+    PickNodeSampledWorker(pool, tree, tree, &best, &best_cost, split_cost, &seed, lines);
+
+    if (best != nullptr)
+    {
+      picknode_counter.stats.sampled_picks++;
+    }
+  }
+
+  if (best == nullptr)
+  {
+    // the sampled lines were all unusable, so no need to try them again
+    PickNodeWorker(pool, tree, tree, &best, &best_cost, split_cost, lines);
+  }
 
   if (HAS_BIT(config.debug, DEBUG_PICKNODE))
   {
@@ -753,6 +1034,53 @@ seg_t *PickNode(quadtree_c *tree, int depth, double split_cost, bool fast)
   return best;
 }
 
+static std::mutex picknode_lock;
+static picknode_stats_t picknode_total;
+
+static void AddPickNodeStats(picknode_stats_t &dest, const picknode_stats_t &src)
+{
+  dest.candidates += src.candidates;
+  dest.pruned += src.pruned;
+  dest.fast_picks += src.fast_picks;
+  dest.sampled_picks += src.sampled_picks;
+  dest.colinear += src.colinear;
+  dest.boxes_whole += src.boxes_whole;
+  dest.segs_tested += src.segs_tested;
+  dest.splits += src.splits;
+  dest.intersections += src.intersections;
+}
+
+picknode_counter_s::~picknode_counter_s(void)
+{
+  std::lock_guard<std::mutex> guard(picknode_lock);
+  AddPickNodeStats(picknode_total, stats);
+}
+
+void ReportPickNodeStats(const char *level_name)
+{
+  std::lock_guard<std::mutex> guard(picknode_lock);
+
+  picknode_stats_t total = picknode_total;
+  AddPickNodeStats(total, picknode_counter.stats);
+
+  picknode_total = picknode_stats_t{};
+  picknode_counter.stats = picknode_stats_t{};
+
+  double pruned_pct = 0.0;
+
+  if (total.candidates > 0)
+  {
+    pruned_pct = 100.0 * static_cast<double>(total.pruned) / static_cast<double>(total.candidates);
+  }
+
+  PrintLine(LOG_NORMAL, "[%s] %s: %zu candidates, %zu colinear skipped, %zu pruned early (%.1f%%)", __func__, level_name,
+            total.candidates, total.colinear, total.pruned, pruned_pct);
+  PrintLine(LOG_NORMAL, "[%s] %s: %zu fast picks, %zu sampled picks", __func__, level_name, total.fast_picks,
+            total.sampled_picks);
+  PrintLine(LOG_NORMAL, "[%s] %s: %zu boxes whole, %zu segs tested, %zu splits, %zu intersections", __func__, level_name,
+            total.boxes_whole, total.segs_tested, total.splits, total.intersections);
+}
+
 static void ListAddSeg(seg_t **list_ptr, seg_t *seg)
 {
   seg->next = *list_ptr;
@@ -775,7 +1103,7 @@ static void ListAddSeg(seg_t **list_ptr, seg_t *seg)
 //       it is important that both these routines follow the exact
 //       same logic when determining which segs should go left, right
 //       or be split.
-void DivideOneSeg(level_t &level, seg_t *seg, seg_t *part, seg_t **left_list, seg_t **right_list, intersection_t **cut_list)
+void DivideOneSeg(level_t &level, seg_t *seg, seg_t *part, seg_t **left_list, seg_t **right_list, cutlist_t *cut_list)
 {
   /* get state of lines' relation to each other */
   double a = part->PerpDist(seg->psx, seg->psy);
@@ -791,8 +1119,8 @@ void DivideOneSeg(level_t &level, seg_t *seg, seg_t *part, seg_t **left_list, se
   /* check for being on the same line */
   if (fabs(a) <= DIST_EPSILON && fabs(b) <= DIST_EPSILON)
   {
-    AddIntersection(level, cut_list, seg->start, part, self_ref);
-    AddIntersection(level, cut_list, seg->end, part, self_ref);
+    AddIntersection(cut_list, seg->start, part, self_ref);
+    AddIntersection(cut_list, seg->end, part, self_ref);
 
     // this seg runs along the same line as the partition.  check
     // whether it goes in the same direction or the opposite.
@@ -813,11 +1141,11 @@ void DivideOneSeg(level_t &level, seg_t *seg, seg_t *part, seg_t **left_list, se
   {
     if (a < DIST_EPSILON)
     {
-      AddIntersection(level, cut_list, seg->start, part, self_ref);
+      AddIntersection(cut_list, seg->start, part, self_ref);
     }
     else if (b < DIST_EPSILON)
     {
-      AddIntersection(level, cut_list, seg->end, part, self_ref);
+      AddIntersection(cut_list, seg->end, part, self_ref);
     }
 
     ListAddSeg(right_list, seg);
@@ -829,11 +1157,11 @@ void DivideOneSeg(level_t &level, seg_t *seg, seg_t *part, seg_t **left_list, se
   {
     if (a > -DIST_EPSILON)
     {
-      AddIntersection(level, cut_list, seg->start, part, self_ref);
+      AddIntersection(cut_list, seg->start, part, self_ref);
     }
     else if (b > -DIST_EPSILON)
     {
-      AddIntersection(level, cut_list, seg->end, part, self_ref);
+      AddIntersection(cut_list, seg->end, part, self_ref);
     }
 
     ListAddSeg(left_list, seg);
@@ -847,7 +1175,7 @@ void DivideOneSeg(level_t &level, seg_t *seg, seg_t *part, seg_t **left_list, se
 
   seg_t *new_seg = SplitSeg(level, seg, x, y);
 
-  AddIntersection(level, cut_list, seg->end, part, self_ref);
+  AddIntersection(cut_list, seg->end, part, self_ref);
 
   if (a < 0)
   {
@@ -861,47 +1189,122 @@ void DivideOneSeg(level_t &level, seg_t *seg, seg_t *part, seg_t **left_list, se
   }
 }
 
-// remove all the segs from the list, partitioning them into the left
-// or right lists based on the given partition line.  Adds any
-// intersections into the intersection list as it goes.
-void SeparateSegs(level_t &level, quadtree_c *tree, seg_t *part, seg_t **left_list, seg_t **right_list,
-                  intersection_t **cut_list)
+// split one box of the quadtree by the partition line.  boxes which
+// are entirely on one side are handed over whole.  the segs of boxes
+// which the line crosses are divided into the left and right lists,
+// and a box of the same size takes their place on each side, holding
+// whatever its children gave to that side.
+static void SplitQuadtree(level_t &level, uint32_t tree, seg_t *part, uint32_t *left, uint32_t *right, seg_t **left_list,
+                          seg_t **right_list, cutlist_t *cut_list)
 {
-  while (tree->list != nullptr)
+  quadtree_pool_c &pool = level.quadtrees;
+
+  *left = NO_QUADTREE;
+  *right = NO_QUADTREE;
+
+  if (pool[tree].Empty())
+  {
+    pool.FreeTree(tree);
+    return;
+  }
+
+  int side = OnLineSide(&pool[tree], part);
+
+  if (side < 0)
+  {
+    *left = tree;
+    return;
+  }
+
+  if (side > 0)
+  {
+    *right = tree;
+    return;
+  }
+
+  while (pool[tree].list != nullptr)
   {
-    seg_t *seg = tree->list;
-    tree->list = seg->next;
+    seg_t *seg = pool[tree].list;
+    pool[tree].list = seg->next;
 
-    seg->quad = nullptr;
+    seg->quad = NO_QUADTREE;
     DivideOneSeg(level, seg, part, left_list, right_list, cut_list);
   }
 
-  // recursively handle sub-blocks
-  if (tree->subs[0] != nullptr)
+  *left = pool.New(pool[tree].x1, pool[tree].y1, pool[tree].x2, pool[tree].y2);
+  *right = pool.New(pool[tree].x1, pool[tree].y1, pool[tree].x2, pool[tree].y2);
+
+  for (size_t c = 0; c < 2; c++)
   {
-    SeparateSegs(level, tree->subs[0], part, left_list, right_list, cut_list);
-    SeparateSegs(level, tree->subs[1], part, left_list, right_list, cut_list);
+    uint32_t sub = pool[tree].subs[c];
+
+    if (sub == NO_QUADTREE)
+    {
+      continue;
+    }
+
+    uint32_t L, R;
+    SplitQuadtree(level, sub, part, &L, &R, left_list, right_list, cut_list);
+
+    pool[tree].subs[c] = NO_QUADTREE;
+    pool[*left].subs[c] = L;
+    pool[*right].subs[c] = R;
+
+    if (L != NO_QUADTREE)
+    {
+      pool[*left].real_num += pool[L].real_num;
+      pool[*left].mini_num += pool[L].mini_num;
+    }
+
+    if (R != NO_QUADTREE)
+    {
+      pool[*right].real_num += pool[R].real_num;
+      pool[*right].mini_num += pool[R].mini_num;
+    }
   }
 
-  // this quadtree_c is empty now
+  pool.Free(tree);
 }
 
-// compute the boundary of the list of segs
-void FindLimits2(seg_t *list, bbox_t *bbox)
+// divide the quadtree in two along the partition line, into a tree for
+// each side.  Boxes away from the line are reused as they are, and the
+// segs near it are divided and added to the box of their side which
+// holds them.  Adds any intersections into the intersection list as it
+// goes.
+void SeparateSegs(level_t &level, uint32_t tree, seg_t *part, uint32_t *left, uint32_t *right, cutlist_t *cut_list)
 {
-  // empty list?
-  if (list == nullptr)
+  auto mark = Benchmarker(__func__);
+
+  quadtree_pool_c &pool = level.quadtrees;
+
+  int x1 = pool[tree].x1;
+  int y1 = pool[tree].y1;
+  int x2 = pool[tree].x2;
+  int y2 = pool[tree].y2;
+
+  seg_t *lefts = nullptr;
+  seg_t *rights = nullptr;
+
+  SplitQuadtree(level, tree, part, left, right, &lefts, &rights, cut_list);
+
+  // the partition seg always touches the top box, but be safe
+  if (*left == NO_QUADTREE)
   {
-    bbox->minx = 0;
-    bbox->miny = 0;
-    bbox->maxx = 4;
-    bbox->maxy = 4;
-    return;
+    *left = pool.New(x1, y1, x2, y2);
   }
 
-  bbox->minx = bbox->miny = SHRT_MAX;
-  bbox->maxx = bbox->maxy = SHRT_MIN;
+  if (*right == NO_QUADTREE)
+  {
+    *right = pool.New(x1, y1, x2, y2);
+  }
+
+  QuadtreeAddList(pool, *left, lefts);
+  QuadtreeAddList(pool, *right, rights);
+}
 
+// grow the boundary to hold the list of segs
+static void AddLimits(const seg_t *list, bbox_t *bbox)
+{
   for (; list != nullptr; list = list->next)
   {
     double x1 = list->start->x;
@@ -921,32 +1324,87 @@ void FindLimits2(seg_t *list, bbox_t *bbox)
   }
 }
 
-// analyse the intersection list, and add any needed minisegs to the
-// given seg lists (one miniseg on each side).  All the intersection
-// structures will be freed back into a quick-alloc list.
-void AddMinisegs(level_t &level, intersection_t *cut_list, seg_t *part, seg_t **left_list, seg_t **right_list)
+// compute the boundary of the list of segs
+void FindLimits2(seg_t *list, bbox_t *bbox)
 {
-  intersection_t *cut, *next;
-
-  if (HAS_BIT(config.debug, DEBUG_CUTLIST))
+  // empty list?
+  if (list == nullptr)
   {
-    PrintLine(LOG_DEBUG, "[%s] CUT LIST:", __func__);
-    PrintLine(LOG_DEBUG, "[%s] PARTITION: (%1.1f,%1.1f) += (%1.1f,%1.1f)", __func__, part->psx, part->psy, part->pdx,
-              part->pdy);
+    bbox->minx = 0;
+    bbox->miny = 0;
+    bbox->maxx = 4;
+    bbox->maxy = 4;
+    return;
+  }
+
+  bbox->minx = bbox->miny = SHRT_MAX;
+  bbox->maxx = bbox->maxy = SHRT_MIN;
+
+  AddLimits(list, bbox);
+}
+
+static void FindLimitsWorker(const quadtree_pool_c &pool, uint32_t tree, bbox_t *bbox)
+{
+  AddLimits(pool[tree].list, bbox);
 
-    for (cut = cut_list; cut; cut = cut->next)
+  for (size_t c = 0; c < 2; c++)
+  {
+    if (pool[tree].subs[c] != NO_QUADTREE)
     {
-      PrintLine(LOG_DEBUG, "[%s] Vertex %zu (%1.1f,%1.1f)  Along %1.2f  [%d/%d]  %s", __func__, cut->vertex->index,
-                cut->vertex->x, cut->vertex->y, cut->along_dist, cut->open_before ? 1 : 0, cut->open_after ? 1 : 0,
-                cut->self_ref ? "SELFREF" : "");
+      FindLimitsWorker(pool, pool[tree].subs[c], bbox);
+    }
+  }
+}
+
+// compute the boundary of the segs in the quadtree
+static void FindLimitsQuadtree(const quadtree_pool_c &pool, uint32_t tree, bbox_t *bbox)
+{
+  // empty tree?
+  if (pool[tree].Empty())
+  {
+    bbox->minx = 0;
+    bbox->miny = 0;
+    bbox->maxx = 4;
+    bbox->maxy = 4;
+    return;
+  }
+
+  bbox->minx = bbox->miny = SHRT_MAX;
+  bbox->maxx = bbox->maxy = SHRT_MIN;
+
+  FindLimitsWorker(pool, tree, bbox);
+}
+
+// analyse the sorted intersection list, and add any needed minisegs
+// to the given seg lists (one miniseg on each side).
+void AddMinisegs(level_t &level, const cutlist_t *cut_list, seg_t *part, seg_t **left_list, seg_t **right_list)
+{
+  auto mark = Benchmarker(__func__);
+
+  const std::vector<uint32_t> &sorted = cut_list->sorted;
+
+  if (HAS_BIT(config.debug, DEBUG_CUTLIST))
+  {
+    PrintLine(LOG_DEBUG, "[%s] CUT LIST:", __func__);
+    PrintLine(LOG_DEBUG, "[%s] PARTITION: (%1.1f,%1.1f) += (%1.1f,%1.1f)", __func__, part->psx, part->psy, part->pdx,
+              part->pdy);
+
+    for (uint32_t index : sorted)
+    {
+      const intersection_t *cut = &cut_list->cuts[index];
+
+      PrintLine(LOG_DEBUG, "[%s] Vertex %zu (%1.1f,%1.1f)  Along %1.2f  [%d/%d]  %s", __func__, cut->vertex->index,
+                cut->vertex->x, cut->vertex->y, cut->along_dist, cut->open_before ? 1 : 0, cut->open_after ? 1 : 0,
+                cut->self_ref ? "SELFREF" : "");
     }
   }
 
   // find open gaps in the intersection list, convert to minisegs
 
-  for (cut = cut_list; cut && cut->next; cut = cut->next)
+  for (size_t i = 0; i + 1 < sorted.size(); i++)
   {
-    next = cut->next;
+    const intersection_t *cut = &cut_list->cuts[sorted[i]];
+    const intersection_t *next = &cut_list->cuts[sorted[i + 1]];
 
     // sanity check
     double len = next->along_dist - cut->along_dist;
@@ -1079,127 +1537,388 @@ int PointOnLineSide(const seg_t *seg, double x, double y)
 /* ----- quad-tree routines ------------------------------------ */
 
 quadtree_c::quadtree_c(int _x1, int _y1, int _x2, int _y2)
-    : x1(_x1), y1(_y1), x2(_x2), y2(_y2), real_num(0), mini_num(0), list(nullptr)
+    : x1(_x1), y1(_y1), x2(_x2), y2(_y2), subs{NO_QUADTREE, NO_QUADTREE}, real_num(0), mini_num(0), list(nullptr)
 {
-  int dx = x2 - x1;
-  int dy = y2 - y1;
+}
 
-  if (dx <= 320 && dy <= 320)
+uint32_t quadtree_pool_c::New(int x1, int y1, int x2, int y2)
+{
+  if (!unused.empty())
   {
-    // leaf node
-    subs[0] = nullptr;
-    subs[1] = nullptr;
+    uint32_t index = unused.back();
+    unused.pop_back();
+
+    boxes[index] = quadtree_c(x1, y1, x2, y2);
+    return index;
   }
-  else if (dx >= dy)
+
+  if (boxes.size() >= NO_QUADTREE)
   {
-    subs[0] = new quadtree_c(x1, y1, x1 + dx / 2, y2);
-    subs[1] = new quadtree_c(x1 + dx / 2, y1, x2, y2);
+    PrintLine(LOG_ERROR, "ERROR: Too many quadtree boxes");
   }
-  else
+
+  boxes.emplace_back(x1, y1, x2, y2);
+
+  return static_cast<uint32_t>(boxes.size() - 1);
+}
+
+void quadtree_pool_c::Free(uint32_t index)
+{
+  unused.push_back(index);
+}
+
+void quadtree_pool_c::FreeTree(uint32_t index)
+{
+  for (size_t c = 0; c < 2; c++)
   {
-    subs[0] = new quadtree_c(x1, y1, x2, y1 + dy / 2);
-    subs[1] = new quadtree_c(x1, y1 + dy / 2, x2, y2);
+    if (boxes[index].subs[c] != NO_QUADTREE)
+    {
+      FreeTree(boxes[index].subs[c]);
+    }
   }
+
+  Free(index);
 }
 
-quadtree_c::~quadtree_c(void)
+void quadtree_pool_c::Clear(void)
 {
-  if (subs[0] != nullptr)
+  std::vector<quadtree_c>().swap(boxes);
+  std::vector<uint32_t>().swap(unused);
+}
+
+// which half of the box the seg fits in, -1 for the lower half, +1 for
+// the higher half, or 0 when it straddles the middle.  Division always
+// happens across the longer side of the box.
+static int QuadtreeHalf(const quadtree_c *quadtree, const seg_t *seg)
+{
+  int dx = quadtree->x2 - quadtree->x1;
+  int dy = quadtree->y2 - quadtree->y1;
+
+  if (dx >= dy)
   {
-    delete subs[0];
+    int mid = quadtree->x1 + dx / 2;
+
+    if (std::min(seg->start->x, seg->end->x) > mid) return +1;
+    if (std::max(seg->start->x, seg->end->x) < mid) return -1;
   }
-  if (subs[1] != nullptr)
+  else
   {
-    delete subs[1];
+    int mid = quadtree->y1 + dy / 2;
+
+    if (std::min(seg->start->y, seg->end->y) > mid) return +1;
+    if (std::max(seg->start->y, seg->end->y) < mid) return -1;
   }
+
+  return 0;
 }
 
-void AddSeg(quadtree_c *quadtree, seg_t *seg)
+//
+// Decide whether a box holding 'count' segs gets divided, where 'lo'
+// and 'hi' of them would fit in each half.
+//
+// The SAH-like policy compares the segs tested when a partition line
+// crosses the box.  As a leaf, that is every seg.  Divided, it is the
+// straddling segs, two box tests, and the segs of each half weighted by
+// the chance the line crosses that half too, which goes with the ratio
+// of the perimeters.
+//
+static bool QuadtreeWantSplit(const quadtree_c *quadtree, const quadtree_params_t &params, size_t count, size_t lo,
+                              size_t hi)
 {
-  // update seg counts
-  if (seg->linedef != nullptr)
+  int dx = quadtree->x2 - quadtree->x1;
+  int dy = quadtree->y2 - quadtree->y1;
+
+  switch (params.policy)
+  {
+  case QUAD_Fixed:
+    return dx > params.leaf_size || dy > params.leaf_size;
+
+  case QUAD_Segs:
+    return count > params.max_segs && std::max(dx, dy) > params.leaf_size;
+
+  case QUAD_SAH:
   {
-    quadtree->real_num++;
+    if (std::max(dx, dy) <= params.leaf_size)
+    {
+      return false;
+    }
+
+    auto perimeter = static_cast<double>(dx + dy);
+    auto half_lo = static_cast<double>((dx >= dy) ? dx / 2 + dy : dx + dy / 2);
+    auto half_hi = perimeter - half_lo + static_cast<double>(std::min(dx, dy));
+
+    double leaf_cost = static_cast<double>(count);
+    double split_cost = static_cast<double>(count - lo - hi) + 2.0 * QUAD_BOX_COST
+                        + (half_lo * static_cast<double>(lo) + half_hi * static_cast<double>(hi)) / perimeter;
+
+    return split_cost < leaf_cost;
   }
-  else
+
+  default:
+    return false;
+  }
+}
+
+void FillQuadtree(quadtree_pool_c &pool, uint32_t index, seg_t *list, const quadtree_params_t &params)
+{
+  // valid until the children are created
+  quadtree_c *quadtree = &pool[index];
+
+  size_t count = 0;
+  size_t lo = 0;
+  size_t hi = 0;
+
+  // the fixed policy does not care about the counts
+  if (params.policy != QUAD_Fixed)
   {
-    quadtree->mini_num++;
+    for (const seg_t *seg = list; seg; seg = seg->next)
+    {
+      int half = QuadtreeHalf(quadtree, seg);
+
+      count++;
+
+      if (half < 0) lo++;
+      if (half > 0) hi++;
+    }
   }
 
-  if (quadtree->subs[0] != nullptr)
+  bool split = list != nullptr && QuadtreeWantSplit(quadtree, params, count, lo, hi);
+
+  // the halves keep the order of the list, so every seg ends up in its
+  // box in the same order as if it was added on its own
+  seg_t *lo_list = nullptr;
+  seg_t *hi_list = nullptr;
+  seg_t **lo_tail = &lo_list;
+  seg_t **hi_tail = &hi_list;
+
+  while (list != nullptr)
   {
-    double x_min = std::min(seg->start->x, seg->end->x);
-    double y_min = std::min(seg->start->y, seg->end->y);
+    seg_t *seg = list;
+    list = seg->next;
 
-    double x_max = std::max(seg->start->x, seg->end->x);
-    double y_max = std::max(seg->start->y, seg->end->y);
+    // update seg counts
+    if (seg->linedef != nullptr)
+    {
+      quadtree->real_num++;
+    }
+    else
+    {
+      quadtree->mini_num++;
+    }
 
-    if ((quadtree->x2 - quadtree->x1) >= (quadtree->y2 - quadtree->y1))
+    int half = split ? QuadtreeHalf(quadtree, seg) : 0;
+
+    if (half < 0)
+    {
+      *lo_tail = seg;
+      lo_tail = &seg->next;
+    }
+    else if (half > 0)
     {
-      if (x_min > quadtree->subs[1]->x1)
+      *hi_tail = seg;
+      hi_tail = &seg->next;
+    }
+    else
+    {
+      // link into this node
+      ListAddSeg(&quadtree->list, seg);
+
+      seg->quad = index;
+    }
+  }
+
+  if (!split)
+  {
+    return;
+  }
+
+  *lo_tail = nullptr;
+  *hi_tail = nullptr;
+
+  int x1 = quadtree->x1;
+  int y1 = quadtree->y1;
+  int x2 = quadtree->x2;
+  int y2 = quadtree->y2;
+
+  int dx = x2 - x1;
+  int dy = y2 - y1;
+
+  // the halves holding no segs are left out
+  if (lo_list != nullptr)
+  {
+    uint32_t sub = (dx >= dy) ? pool.New(x1, y1, x1 + dx / 2, y2) : pool.New(x1, y1, x2, y1 + dy / 2);
+    pool[index].subs[0] = sub;
+    FillQuadtree(pool, sub, lo_list, params);
+  }
+
+  if (hi_list != nullptr)
+  {
+    uint32_t sub = (dx >= dy) ? pool.New(x1 + dx / 2, y1, x2, y2) : pool.New(x1, y1 + dy / 2, x2, y2);
+    pool[index].subs[1] = sub;
+    FillQuadtree(pool, sub, hi_list, params);
+  }
+}
+
+// whether the seg fits completely inside the box.
+static bool QuadtreeHolds(const quadtree_c *quadtree, const seg_t *seg)
+{
+  return std::min(seg->start->x, seg->end->x) > quadtree->x1 && std::max(seg->start->x, seg->end->x) < quadtree->x2 &&
+         std::min(seg->start->y, seg->end->y) > quadtree->y1 && std::max(seg->start->y, seg->end->y) < quadtree->y2;
+}
+
+void QuadtreeAddList(quadtree_pool_c &pool, uint32_t quadtree, seg_t *list)
+{
+  while (list != nullptr)
+  {
+    seg_t *seg = list;
+    list = seg->next;
+
+    // go down to the smallest box which holds the seg
+    uint32_t index = quadtree;
+
+    for (;;)
+    {
+      quadtree_c *box = &pool[index];
+
+      // update seg counts
+      if (seg->linedef != nullptr)
       {
-        AddSeg(quadtree->subs[1], seg);
-        return;
+        box->real_num++;
       }
-      else if (x_max < quadtree->subs[0]->x2)
+      else
       {
-        AddSeg(quadtree->subs[0], seg);
-        return;
+        box->mini_num++;
       }
-    }
-    else
-    {
-      if (y_min > quadtree->subs[1]->y1)
+
+      uint32_t into = NO_QUADTREE;
+
+      for (size_t c = 0; c < 2 && into == NO_QUADTREE; c++)
       {
-        AddSeg(quadtree->subs[1], seg);
-        return;
+        if (box->subs[c] != NO_QUADTREE && QuadtreeHolds(&pool[box->subs[c]], seg))
+        {
+          into = box->subs[c];
+        }
       }
-      else if (y_max < quadtree->subs[0]->y2)
+
+      if (into == NO_QUADTREE)
       {
-        AddSeg(quadtree->subs[0], seg);
-        return;
+        break;
       }
+
+      index = into;
+    }
+
+    // link into this node
+    ListAddSeg(&pool[index].list, seg);
+
+    seg->quad = index;
+  }
+}
+
+uint32_t CompactQuadtree(quadtree_pool_c &pool, uint32_t quadtree, const seg_t *part)
+{
+  quadtree_c *box = &pool[quadtree];
+
+  for (size_t c = 0; c < 2; c++)
+  {
+    uint32_t sub = box->subs[c];
+
+    if (sub == NO_QUADTREE)
+    {
+      continue;
+    }
+
+    if (pool[sub].Empty())
+    {
+      pool.FreeTree(sub);
+      box->subs[c] = NO_QUADTREE;
+    }
+    else if (OnLineSide(&pool[sub], part) == 0)
+    {
+      box->subs[c] = CompactQuadtree(pool, sub, part);
     }
   }
 
-  // link into this node
+  // a box with no segs of its own and a single child is just a detour
+  if (box->list == nullptr && (box->subs[0] == NO_QUADTREE) != (box->subs[1] == NO_QUADTREE))
+  {
+    uint32_t only = (box->subs[0] != NO_QUADTREE) ? box->subs[0] : box->subs[1];
 
-  ListAddSeg(&quadtree->list, seg);
+    pool.Free(quadtree);
 
-  seg->quad = quadtree;
+    return only;
+  }
+
+  return quadtree;
 }
 
-void AddList(quadtree_c *quadtree, seg_t *new_list)
+quadtree_params_t ChooseQuadtreeParams(seg_t *list, const bbox_t *bounds)
 {
-  while (new_list != nullptr)
+  quadtree_params_t params;
+
+  params.policy = config.quad_policy;
+  params.leaf_size = config.quad_size;
+  params.max_segs = config.quad_segs;
+
+  if (params.policy != QUAD_Auto)
   {
-    seg_t *seg = new_list;
-    new_list = seg->next;
+    if (params.policy != QUAD_Fixed)
+    {
+      params.leaf_size = QUAD_MIN_SIZE;
+    }
 
-    AddSeg(quadtree, seg);
+    return params;
   }
+
+  size_t count = 0;
+
+  for (const seg_t *seg = list; seg; seg = seg->next)
+  {
+    count++;
+  }
+
+  // segs per 128x128 area of the map
+  double area = std::max(static_cast<double>(bounds->maxx - bounds->minx) * static_cast<double>(bounds->maxy - bounds->miny),
+                         1.0);
+  double density = std::max(static_cast<double>(count) * (128.0 * 128.0) / area, 0.01);
+
+  auto min_size = static_cast<int32_t>(128.0 * sqrt(QUAD_AUTO_MIN_SEGS / density));
+
+  params.policy = QUAD_Segs;
+  params.leaf_size = std::clamp(min_size, QUAD_MIN_SIZE, QUAD_AUTO_MAX_SIZE);
+
+  if (HAS_BIT(config.debug, DEBUG_BUILDER))
+  {
+    PrintLine(LOG_DEBUG, "[%s] %zu segs, %1.2f per block, leaves hold up to %zu segs, down to %d units", __func__, count,
+              density, params.max_segs, params.leaf_size);
+  }
+
+  return params;
 }
 
-void ConvertToList(quadtree_c *quadtree, seg_t **_list)
+void ConvertToList(quadtree_pool_c &pool, uint32_t quadtree, seg_t **_list)
 {
-  while (quadtree->list != nullptr)
+  while (pool[quadtree].list != nullptr)
   {
-    seg_t *seg = quadtree->list;
-    quadtree->list = seg->next;
+    seg_t *seg = pool[quadtree].list;
+    pool[quadtree].list = seg->next;
 
+    seg->quad = NO_QUADTREE;
     ListAddSeg(_list, seg);
   }
 
-  if (quadtree->subs[0] != nullptr)
+  for (size_t c = 0; c < 2; c++)
   {
-    ConvertToList(quadtree->subs[0], _list);
-    ConvertToList(quadtree->subs[1], _list);
+    if (pool[quadtree].subs[c] != NO_QUADTREE)
+    {
+      ConvertToList(pool, pool[quadtree].subs[c], _list);
+    }
   }
 
   // this quadtree is empty now
 }
 
-int OnLineSide(quadtree_c *quadtree, const seg_t *part)
+int OnLineSide(const quadtree_c *quadtree, const seg_t *part)
 {
   // expand bounds a bit, adds some safety and loses nothing
   auto tx1 = static_cast<double>(quadtree->x1) - 0.4;
@@ -1257,13 +1976,6 @@ seg_t *CreateOneSeg(level_t &level, linedef_t *line, vertex_t *start, vertex_t *
 {
   seg_t *seg = NewSeg(level);
 
-  // check for bad sidedef
-  if (side->sector == nullptr)
-  {
-    PrintLine(LOG_NORMAL, "WARNING: Bad sidedef on linedef #%zu (Z_CheckHeap error)", line->index);
-    config.total_warnings++;
-  }
-
   // handle overlapping vertices, pick a nominal one
   if (start->overlap)
   {
@@ -1288,6 +2000,43 @@ seg_t *CreateOneSeg(level_t &level, linedef_t *line, vertex_t *start, vertex_t *
   return seg;
 }
 
+//
+// Warn about the sidedefs CreateSegs() will skip or trust anyway.
+// Kept apart from it, since auto-cost creates the segs many times.
+//
+void CheckLinedefSides(const level_t &level)
+{
+  for (const linedef_t *line : level.linedefs)
+  {
+    if (HAS_BIT(line->effects, FX_ZeroLength) || line->overlap != nullptr)
+    {
+      continue;
+    }
+
+    if (line->right == nullptr)
+    {
+      PrintLine(LOG_NORMAL, "WARNING: Linedef #%zu has no front/right sidedef!", line->index);
+      config.total_warnings++;
+    }
+    else if (line->right->sector == nullptr && HAS_NONE(line->effects, FX_DoNotRenderFront))
+    {
+      PrintLine(LOG_NORMAL, "WARNING: Bad sidedef on linedef #%zu (Z_CheckHeap error)", line->index);
+      config.total_warnings++;
+    }
+
+    if (line->left == nullptr && HAS_BIT(line->effects, FX_TwoSided))
+    {
+      PrintLine(LOG_NORMAL, "WARNING: Linedef #%zu is 2s but has no back/left sidedef", line->index);
+      config.total_warnings++;
+    }
+    else if (line->left != nullptr && line->left->sector == nullptr && HAS_NONE(line->effects, FX_DoNotRenderBack))
+    {
+      PrintLine(LOG_NORMAL, "WARNING: Bad sidedef on linedef #%zu (Z_CheckHeap error)", line->index);
+      config.total_warnings++;
+    }
+  }
+}
+
 //
 // Initially create all segs, one for each linedef.
 // Must be called *after* InitBlockmap().
@@ -1316,23 +2065,13 @@ seg_t *CreateSegs(level_t &level)
       continue;
     }
 
-    if (line->right == nullptr)
-    {
-      PrintLine(LOG_NORMAL, "WARNING: Linedef #%zu has no front/right sidedef!", line->index);
-      config.total_warnings++;
-    }
-    else if (line->right != nullptr && HAS_NONE(line->effects, FX_DoNotRenderFront))
+    if (line->right != nullptr && HAS_NONE(line->effects, FX_DoNotRenderFront))
     {
       right = CreateOneSeg(level, line, line->start, line->end, line->right, false);
       ListAddSeg(&list, right);
     }
 
-    if (line->left == nullptr && HAS_BIT(line->effects, FX_TwoSided))
-    {
-      PrintLine(LOG_NORMAL, "WARNING: Linedef #%zu is 2s but has no back/left sidedef", line->index);
-      config.total_warnings++;
-    }
-    else if (line->left != nullptr && HAS_NONE(line->effects, FX_DoNotRenderBack))
+    if (line->left != nullptr && HAS_NONE(line->effects, FX_DoNotRenderBack))
     {
       left = CreateOneSeg(level, line, line->end, line->start, line->left, true);
       ListAddSeg(&list, left);
@@ -1351,10 +2090,10 @@ seg_t *CreateSegs(level_t &level)
   return list;
 }
 
-quadtree_c *TreeFromSegList(seg_t *list, const bbox_t *bounds)
+uint32_t TreeFromSegList(quadtree_pool_c &pool, seg_t *list, const bbox_t *bounds, const quadtree_params_t &params)
 {
-  quadtree_c *tree = new quadtree_c(bounds->minx, bounds->miny, bounds->maxx, bounds->maxy);
-  AddList(tree, list);
+  uint32_t tree = pool.New(bounds->minx, bounds->miny, bounds->maxx, bounds->maxy);
+  FillQuadtree(pool, tree, list, params);
   return tree;
 }
 
@@ -1381,25 +2120,6 @@ void DetermineMiddle(subsec_t *subsec)
   }
 }
 
-void AddToTail(subsec_t *subsec, seg_t *seg)
-{
-  seg->next = nullptr;
-
-  if (subsec->seg_list == nullptr)
-  {
-    subsec->seg_list = seg;
-    return;
-  }
-
-  seg_t *tail = subsec->seg_list;
-  while (tail->next != nullptr)
-  {
-    tail = tail->next;
-  }
-
-  tail->next = seg;
-}
-
 void ClockwiseOrder(subsec_t *subsec)
 {
   seg_t *seg;
@@ -1414,39 +2134,15 @@ void ClockwiseOrder(subsec_t *subsec)
   for (seg = subsec->seg_list; seg; seg = seg->next)
   {
     // compute angles now
-    seg->cmp_angle = ComputeAngle(seg->start->x - subsec->mid_x, seg->start->y - subsec->mid_y);
+    seg->cmp_angle = ComputePseudoAngle(seg->start->x - subsec->mid_x, seg->start->y - subsec->mid_y);
     array.push_back(seg);
   }
 
   // sort segs by angle (from the middle point to the start vertex).
-  // the desired order (clockwise) means descending angles.
-  // since # of segs is usually small, a bubble sort is fast enough.
-
-  size_t i = 0;
-
-  while (i + 1 < array.size())
-  {
-    seg_t *A = array[i];
-    seg_t *B = array[i + 1];
-
-    if (A->cmp_angle < B->cmp_angle)
-    {
-      // swap 'em
-      array[i] = B;
-      array[i + 1] = A;
-
-      // bubble down
-      if (i > 0)
-      {
-        i--;
-      }
-    }
-    else
-    {
-      // bubble up
-      i++;
-    }
-  }
+  // the desired order (clockwise) means descending angles.  segs at the
+  // exact same angle keep their original order.
+  std::stable_sort(array.begin(), array.end(),
+                   [](const seg_t *A, const seg_t *B) { return A->cmp_angle > B->cmp_angle; });
 
   // choose the seg that will be first (the game engine will typically use
   // that to determine the sector).  In particular, we don't like self
@@ -1474,13 +2170,15 @@ void ClockwiseOrder(subsec_t *subsec)
     }
   }
 
-  // transfer sorted array back into sub
+  // transfer sorted array back into sub, linking each seg to the next
   subsec->seg_list = nullptr;
 
-  for (size_t j = 0; j < array.size(); j++)
+  for (size_t j = array.size(); j-- > 0;)
   {
     size_t k = (first + j) % array.size();
-    AddToTail(subsec, array[k]);
+
+    array[k]->next = subsec->seg_list;
+    subsec->seg_list = array[k];
   }
 
   if (HAS_BIT(config.debug, DEBUG_SORTER))
@@ -1576,7 +2274,7 @@ void RenumberSegs(subsec_t *subsec, size_t &cur_seg_index)
 //
 // Create a subsector from a list of segs.
 //
-subsec_t *CreateSubsec(level_t &level, quadtree_c *tree)
+subsec_t *CreateSubsec(level_t &level, uint32_t tree)
 {
   subsec_t *sub = NewSubsec(level);
 
@@ -1585,7 +2283,7 @@ subsec_t *CreateSubsec(level_t &level, quadtree_c *tree)
 
   // copy segs into subsector
   sub->seg_list = nullptr;
-  ConvertToList(tree, &sub->seg_list);
+  ConvertToList(level.quadtrees, tree, &sub->seg_list);
   DetermineMiddle(sub);
 
   if (HAS_BIT(config.debug, DEBUG_SUBSEC))
@@ -1596,112 +2294,173 @@ subsec_t *CreateSubsec(level_t &level, quadtree_c *tree)
   return sub;
 }
 
-void BuildNodes(level_t &level, seg_t *list, int depth, bbox_t *bounds, node_t **N, subsec_t **S, double split_cost, bool fast,
-                bool analysis)
+static void DebugQuadtreeSegs(const quadtree_pool_c &pool, uint32_t tree)
 {
+  for (const seg_t *seg = pool[tree].list; seg; seg = seg->next)
+  {
+    PrintLine(LOG_DEBUG, "[BuildNodes]   %sSEG %p  (%1.1f,%1.1f) -> (%1.1f,%1.1f)", seg->linedef ? "" : "MINI", seg,
+              seg->start->x, seg->start->y, seg->end->x, seg->end->y);
+  }
+
+  for (size_t c = 0; c < 2; c++)
+  {
+    if (pool[tree].subs[c] != NO_QUADTREE)
+    {
+      DebugQuadtreeSegs(pool, pool[tree].subs[c]);
+    }
+  }
+}
+
+//
+// The quadtree is built once for the whole level, then each partition
+// line divides it in two, reusing the boxes which lie on one side of
+// the line.  The tree is consumed.
+//
+static void BuildNodesWorker(level_t &level, uint32_t tree, int depth, bbox_t *bounds, node_t **N, subsec_t **S,
+                             double split_cost, bool fast, bool analysis)
+{
+  auto mark = Benchmarker("BuildNodes");
+  // the recursion is folded in the profile, the trace shows it in bands
+  auto band = Tracer("BuildNodes band", "depth", depth, depth % TRACE_DEPTH_BAND == 0);
+
   *N = nullptr;
   *S = nullptr;
 
   if (HAS_BIT(config.debug, DEBUG_BUILDER))
   {
-    PrintLine(LOG_DEBUG, "[%s] BEGUN @ %d", __func__, depth);
-    for (const seg_t *seg = list; seg; seg = seg->next)
-    {
-      PrintLine(LOG_DEBUG, "[%s]   %sSEG %p  (%1.1f,%1.1f) -> (%1.1f,%1.1f)", __func__, seg->linedef ? "" : "MINI", seg,
-                seg->start->x, seg->start->y, seg->end->x, seg->end->y);
-    }
+    PrintLine(LOG_DEBUG, "[BuildNodes] BEGUN @ %d", depth);
+    DebugQuadtreeSegs(level.quadtrees, tree);
   }
 
   // determine bounds of segs
-  FindLimits2(list, bounds);
-
-  quadtree_c *tree = TreeFromSegList(list, bounds);
+  FindLimitsQuadtree(level.quadtrees, tree, bounds);
 
   /* pick partition line, NONE indicates convexicity */
-  seg_t *part = PickNode(tree, depth, split_cost, fast);
+  seg_t *part = PickNode(level.quadtrees, tree, bounds, depth, split_cost, fast);
 
   if (part == nullptr)
   {
     if (HAS_BIT(config.debug, DEBUG_BUILDER))
     {
-      PrintLine(LOG_DEBUG, "[%s] CONVEX", __func__);
+      PrintLine(LOG_DEBUG, "[BuildNodes] CONVEX");
     }
 
     *S = CreateSubsec(level, tree);
-    delete tree;
+    level.quadtrees.FreeTree(tree);
 
     return;
   }
 
   if (HAS_BIT(config.debug, DEBUG_BUILDER))
   {
-    PrintLine(LOG_DEBUG, "[%s] PARTITION %p (%1.0f,%1.0f) -> (%1.0f,%1.0f)", __func__, part, part->start->x, part->start->y,
-              part->end->x, part->end->y);
+    PrintLine(LOG_DEBUG, "[BuildNodes] PARTITION %p (%1.0f,%1.0f) -> (%1.0f,%1.0f)", part, part->start->x,
+              part->start->y, part->end->x, part->end->y);
   }
 
   node_t *node = NewNode(level);
   *N = node;
 
-  /* divide the segs into two lists: left & right */
-  seg_t *lefts = nullptr;
-  seg_t *rights = nullptr;
-  intersection_t *cut_list = nullptr;
-
-  SeparateSegs(level, tree, part, &lefts, &rights, &cut_list);
+  /* divide the quadtree in two: left & right */
+  uint32_t left = NO_QUADTREE;
+  uint32_t right = NO_QUADTREE;
+  // the level's list is free again, the sides get built after it is used
+  cutlist_t *cut_list = &level.cut_list;
+  cut_list->cuts.clear();
 
-  delete tree;
-  tree = nullptr;
+  SeparateSegs(level, tree, part, &left, &right, cut_list);
+  SortIntersections(cut_list);
 
   /* sanity checks... */
-  if (rights == nullptr)
+  if (level.quadtrees[right].Empty())
   {
     PrintLine(LOG_ERROR, "ERROR: Separated seg-list has empty RIGHT side");
   }
 
-  if (lefts == nullptr)
+  if (level.quadtrees[left].Empty())
   {
     PrintLine(LOG_ERROR, "ERROR: Separated seg-list has empty LEFT side");
   }
 
-  if (cut_list != nullptr)
+  if (!cut_list->sorted.empty())
   {
+    seg_t *lefts = nullptr;
+    seg_t *rights = nullptr;
+
     AddMinisegs(level, cut_list, part, &lefts, &rights);
+
+    QuadtreeAddList(level.quadtrees, left, lefts);
+    QuadtreeAddList(level.quadtrees, right, rights);
   }
 
+  left = CompactQuadtree(level.quadtrees, left, part);
+  right = CompactQuadtree(level.quadtrees, right, part);
+
   SetPartition(node, part);
 
   if (HAS_BIT(config.debug, DEBUG_BUILDER))
   {
-    PrintLine(LOG_DEBUG, "[%s] Going LEFT", __func__);
+    PrintLine(LOG_DEBUG, "[BuildNodes] Going LEFT");
   }
 
   // recursively build the left side
-  BuildNodes(level, lefts, depth + 1, &node->l.bounds, &node->l.node, &node->l.subsec, split_cost, fast, analysis);
+  BuildNodesWorker(level, left, depth + 1, &node->l.bounds, &node->l.node, &node->l.subsec, split_cost, fast, analysis);
 
   if (HAS_BIT(config.debug, DEBUG_BUILDER))
   {
-    PrintLine(LOG_DEBUG, "[%s] Going RIGHT", __func__);
+    PrintLine(LOG_DEBUG, "[BuildNodes] Going RIGHT");
   }
 
   // recursively build the right side
-  BuildNodes(level, rights, depth + 1, &node->r.bounds, &node->r.node, &node->r.subsec, split_cost, fast, analysis);
+  BuildNodesWorker(level, right, depth + 1, &node->r.bounds, &node->r.node, &node->r.subsec, split_cost, fast,
+                   analysis);
 
   if (HAS_BIT(config.debug, DEBUG_BUILDER))
   {
-    PrintLine(LOG_DEBUG, "[%s] DONE", __func__);
+    PrintLine(LOG_DEBUG, "[BuildNodes] DONE");
   }
 }
 
+void BuildNodes(level_t &level, seg_t *list, int depth, bbox_t *bounds, node_t **N, subsec_t **S, double split_cost, bool fast,
+                bool analysis)
+{
+  auto mark = Benchmarker(__func__);
+
+  // the whole level, pick how its quadtrees get divided
+  FindLimits2(list, bounds);
+
+  level.quad_params = ChooseQuadtreeParams(list, bounds);
+
+  uint32_t tree = TreeFromSegList(level.quadtrees, list, bounds, level.quad_params);
+
+  BuildNodesWorker(level, tree, depth, bounds, N, S, split_cost, fast, analysis);
+
+  level.quadtrees.Clear();
+}
+
 void ClockwiseBspTree(level_t &level)
 {
   auto mark = Benchmarker(__func__);
   size_t cur_seg_index = 0;
 
+  // each subsector is sorted on its own, but numbering the segs (and
+  // reporting problems) must still go in subsector order.  Their debug
+  // output would interleave across threads, so it stays serial then.
+  if (HAS_BIT(config.debug, DEBUG_SUBSEC) || HAS_BIT(config.debug, DEBUG_SORTER))
+  {
+    for (subsec_t *sub : level.subsecs)
+    {
+      ClockwiseOrder(sub);
+    }
+  }
+  else
+  {
+    ParallelFor(level.subsecs.size(), [&level](size_t i) { ClockwiseOrder(level.subsecs[i]); });
+  }
+
   for (size_t i = 0; i < level.subsecs.size(); i++)
   {
     subsec_t *sub = level.subsecs[i];
 
-    ClockwiseOrder(sub);
     RenumberSegs(sub, cur_seg_index);
 
     // do some sanity checks
@@ -1735,7 +2494,7 @@ void Normalise(subsec_t *subsec)
         PrintLine(LOG_DEBUG, "[%s] Removing miniseg %p", __func__, seg);
       }
 
-      // this causes SortSegs() to remove the seg
+      // this seg is freed when the BSP lumps are written
       seg->index = SEG_IS_GARBAGE;
       continue;
     }
@@ -1881,7 +2640,7 @@ void RoundOffSubsector(level_t &level, subsec_t *subsec)
       {
         PrintLine(LOG_DEBUG, "[%s] Removing degenerate %p", __func__, seg);
       }
-      // this causes SortSegs() to remove the seg
+      // this seg is freed when the BSP lumps are written
       seg->index = SEG_IS_GARBAGE;
       continue;
     }
@@ -1914,6 +2673,8 @@ void RoundOffSubsector(level_t &level, subsec_t *subsec)
 
 void RoundOffBspTree(level_t &level)
 {
+  auto mark = Benchmarker(__func__);
+
   size_t cur_seg_index = 0;
 
   RoundOffVertices(level);
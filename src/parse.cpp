@@ -24,14 +24,17 @@
 #include <cinttypes>
 #include <cstdlib>
 
-token_kind_e lexer_c::Next(std::string &s)
-{
-  s.clear();
 
+#include <algorithm>
+#include <charconv>
+
+token_kind_e lexer_c::Next(std::string_view &s)
+{
   SkipToNext();
 
   if (pos >= data.size())
   {
+    s = {};
     return TOK_EOF;
   }
 
@@ -53,11 +56,24 @@ token_kind_e lexer_c::Next(std::string &s)
   }
 
   // anything else is a single-character symbol
-  s.push_back(data[pos++]);
+  s = data.substr(pos++, 1);
 
   return TOK_Symbol;
 }
 
+bool lexer_c::Match(char ch)
+{
+  SkipToNext();
+
+  if (pos < data.size() && data[pos] == ch)
+  {
+    pos++;
+    return true;
+  }
+
+  return false;
+}
+
 bool lexer_c::Match(const char *s)
 {
   assert(s);
@@ -117,35 +133,249 @@ void lexer_c::Rewind(void)
   line = 1;
 }
 
-size_t LEX_Index(const std::string &s)
+//
+// Find the next occurrence of ch at or after pos, returns the size of
+// the data when there is none.
+//
+static size_t LEX_Find(std::string_view data, size_t pos, char ch)
+{
+  if (pos >= data.size())
+  {
+    return data.size();
+  }
+
+  const void *p = memchr(data.data() + pos, ch, data.size() - pos);
+
+  return p ? static_cast<size_t>(static_cast<const char *>(p) - data.data()) : data.size();
+}
+
+bool lexer_c::SkipValue(void)
+{
+  SkipToNext();
+
+  // strings are the only values which may contain a ';'
+  if (pos < data.size() && data[pos] == '"')
+  {
+    std::string_view s;
+    ParseString(s);
+    return true;
+  }
+
+  size_t start = pos;
+
+  while (pos < data.size())
+  {
+    // a value never holds any of these, so stop at the first one
+    // instead of running on to a ';' further down.  the caller checks
+    // that it is the ';' which ends the value.
+    size_t end = std::min(data.find_first_of(";}=\"/", pos), data.size());
+
+    line += static_cast<size_t>(std::count(data.begin() + static_cast<ptrdiff_t>(pos),
+                                           data.begin() + static_cast<ptrdiff_t>(end), '\n'));
+    pos = end;
+
+    if (pos >= data.size() || data[pos] != '/')
+    {
+      break;
+    }
+
+    // a comment is skipped here, a lone slash is stepped over
+    size_t old_pos = pos;
+
+    SkipToNext();
+
+    if (pos == old_pos)
+    {
+      pos++;
+    }
+  }
+
+  return pos > start;
+}
+
+bool lexer_c::SkipBlock(void)
+{
+  while (pos < data.size())
+  {
+    size_t end = LEX_Find(data, pos, '}');
+
+    // a string or comment before the brace may be hiding it
+    size_t quote = LEX_Find(data.substr(0, end), pos, '"');
+    size_t slash = LEX_Find(data.substr(0, quote), pos, '/');
+    size_t next = std::min(quote, slash);
+
+    if (next == end)
+    {
+      line += static_cast<size_t>(std::count(data.begin() + static_cast<ptrdiff_t>(pos),
+                                             data.begin() + static_cast<ptrdiff_t>(end), '\n'));
+      pos = end + 1;
+      return true;
+    }
+
+    line += static_cast<size_t>(std::count(data.begin() + static_cast<ptrdiff_t>(pos),
+                                           data.begin() + static_cast<ptrdiff_t>(next), '\n'));
+    pos = next;
+
+    if (pos >= data.size())
+    {
+      break;
+    }
+
+    if (data[pos] == '"')
+    {
+      std::string_view s;
+      ParseString(s);
+      continue;
+    }
+
+    // a comment is skipped here, a lone slash is stepped over
+    size_t old_pos = pos;
+
+    SkipToNext();
+
+    if (pos == old_pos)
+    {
+      pos++;
+    }
+  }
+
+  return false;
+}
+
+//
+// Integers in the UDMF spec may be decimal, octal (leading zero) or
+// hexadecimal (leading 0x), with an optional sign.
+//
+static int64_t LEX_Integer(std::string_view s)
 {
-  return std::strtoumax(s.c_str(), nullptr, 0);
+  const char *p = s.data();
+  const char *end = p + s.size();
+
+  bool negative = false;
+
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = (*p == '-');
+    p++;
+  }
+
+  int base = 10;
+
+  if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+  {
+    base = 16;
+    p += 2;
+  }
+  else if (end - p > 1 && p[0] == '0')
+  {
+    base = 8;
+    p++;
+  }
+
+  // out of range values are clamped, like strtol() does
+  uint64_t mag = 0;
+
+  if (std::from_chars(p, end, mag, base).ec == std::errc::result_out_of_range)
+  {
+    mag = UINT64_MAX;
+  }
+
+  if (negative)
+  {
+    constexpr uint64_t min_mag = static_cast<uint64_t>(INT64_MAX) + 1;
+    return (mag >= min_mag) ? INT64_MIN : -static_cast<int64_t>(mag);
+  }
+
+  return (mag > static_cast<uint64_t>(INT64_MAX)) ? INT64_MAX : static_cast<int64_t>(mag);
+}
+
+size_t LEX_Index(std::string_view s)
+{
+  return static_cast<size_t>(LEX_Integer(s));
 }
 
-int16_t LEX_Int16(const std::string &s)
+int16_t LEX_Int16(std::string_view s)
 {
-  // strtol handles all the integer sequences of the UDMF spec
-  return static_cast<int16_t>(std::strtol(s.c_str(), nullptr, 0));
+  return static_cast<int16_t>(LEX_Integer(s));
 }
 
-int32_t LEX_Int(const std::string &s)
+int32_t LEX_Int(std::string_view s)
 {
-  // strtol handles all the integer sequences of the UDMF spec
-  return static_cast<int32_t>(std::strtol(s.c_str(), nullptr, 0));
+  return static_cast<int32_t>(LEX_Integer(s));
 }
 
-uint32_t LEX_UInt(const std::string &s)
+uint32_t LEX_UInt(std::string_view s)
 {
-  return static_cast<uint32_t>(std::strtoul(s.c_str(), nullptr, 0));
+  return static_cast<uint32_t>(LEX_Integer(s));
 }
 
-double LEX_Double(const std::string &s)
+double LEX_Double(std::string_view s)
 {
+  // fast path: a plain decimal of up to 15 digits fits exactly in the
+  // mantissa, and so does the power of ten, hence a single division is
+  // correctly rounded.  this covers the "123.000" style of every editor.
+  static constexpr double POW10[] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                     1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+  size_t i = 0;
+  bool negative = false;
+
+  if (i < s.size() && (s[i] == '-' || s[i] == '+'))
+  {
+    negative = (s[i] == '-');
+    i++;
+  }
+
+  uint64_t mantissa = 0;
+  size_t digits = 0;
+  size_t frac_digits = 0;
+  bool seen_dot = false;
+
+  for (; i < s.size(); i++)
+  {
+    char ch = s[i];
+
+    if (ch == '.' && !seen_dot)
+    {
+      seen_dot = true;
+      continue;
+    }
+
+    if (ch < '0' || ch > '9')
+    {
+      break;
+    }
+
+    mantissa = mantissa * 10 + static_cast<uint64_t>(ch - '0');
+    digits++;
+
+    if (seen_dot)
+    {
+      frac_digits++;
+    }
+  }
+
+  if (i == s.size() && digits > 0 && digits <= 15)
+  {
+    double val = static_cast<double>(mantissa) / POW10[frac_digits];
+    return negative ? -val : val;
+  }
+
+  // slow path: exponents, very long numbers, etc
   // strtod handles all the floating-point sequences of the UDMF spec
-  return std::strtod(s.c_str(), nullptr);
+  char buffer[64];
+
+  if (s.size() < sizeof(buffer))
+  {
+    memcpy(buffer, s.data(), s.size());
+    buffer[s.size()] = 0;
+    return std::strtod(buffer, nullptr);
+  }
+
+  return std::strtod(std::string(s).c_str(), nullptr);
 }
 
-bool LEX_Boolean(const std::string &s)
+bool LEX_Boolean(std::string_view s)
 {
   if (s.empty())
   {
@@ -155,6 +385,11 @@ bool LEX_Boolean(const std::string &s)
   return (s[0] == 't' || s[0] == 'T');
 }
 
+bool LEX_Equal(std::string_view s, std::string_view name)
+{
+  return s.size() == name.size() && StringCaseCmpMax(s.data(), name.data(), s.size()) == 0;
+}
+
 //----------------------------------------------------------------------------
 
 void lexer_c::SkipToNext(void)
@@ -176,42 +411,31 @@ void lexer_c::SkipToNext(void)
       continue;
     }
 
-    if (ch == DIR_SEP_CH && pos + 1 < data.size())
+    if (ch == '/' && pos + 1 < data.size())
     {
       // single line comment?
-      if (data[pos + 1] == DIR_SEP_CH)
+      if (data[pos + 1] == '/')
       {
-        pos += 2;
-
-        while (pos < data.size() && data[pos] != '\n')
-        {
-          pos++;
-        }
-
+        pos = LEX_Find(data, pos + 2, '\n');
         continue;
       }
 
       // multi-line comment?
       if (data[pos + 1] == '*')
       {
-        pos += 2;
+        size_t start = pos + 2;
 
-        while (pos < data.size())
+        for (pos = LEX_Find(data, start, '*'); pos < data.size(); pos = LEX_Find(data, pos + 1, '*'))
         {
-          if (pos + 1 < data.size() && data[pos] == '*' && data[pos + 1] == DIR_SEP_CH)
+          if (pos + 1 < data.size() && data[pos + 1] == '/')
           {
-            pos += 2;
             break;
           }
-
-          if (data[pos] == '\n')
-          {
-            line += 1;
-          }
-
-          pos++;
         }
 
+        line += static_cast<size_t>(std::count(data.begin() + static_cast<ptrdiff_t>(start),
+                                               data.begin() + static_cast<ptrdiff_t>(pos), '\n'));
+        pos = std::min(pos + 2, data.size());
         continue;
       }
     }
@@ -221,49 +445,46 @@ void lexer_c::SkipToNext(void)
   }
 }
 
-token_kind_e lexer_c::ParseIdentifier(std::string &s)
+token_kind_e lexer_c::ParseIdentifier(std::string_view &s)
 {
-  // NOTE: we lowercase the identifier put into 's'.
+  size_t start = pos;
 
-  for (;;)
+  while (pos < data.size())
   {
     byte ch = static_cast<byte>(data[pos]);
 
-    // don't change a char when high-bit is set (for UTF-8)
-    if (ch < 128)
-    {
-      ch = static_cast<byte>(std::tolower(ch));
-    }
-
     if (!(std::isalnum(ch) || ch == '_' || ch >= 128))
     {
       break;
     }
 
-    s.push_back(static_cast<char>(ch));
     pos++;
   }
 
+  s = data.substr(start, pos - start);
+
   assert(s.size() > 0);
 
   return TOK_Ident;
 }
 
-token_kind_e lexer_c::ParseNumber(std::string &s)
+token_kind_e lexer_c::ParseNumber(std::string_view &s)
 {
+  size_t start = pos;
+
   if (data[pos] == '-' || data[pos] == '+')
   {
     // no digits after the sign?
     if (pos + 1 >= data.size() || !std::isdigit(data[pos + 1]))
     {
-      s.push_back(data[pos++]);
+      s = data.substr(pos++, 1);
       return TOK_Symbol;
     }
   }
 
   for (;;)
   {
-    s.push_back(data[pos++]);
+    pos++;
 
     if (pos >= data.size())
     {
@@ -279,15 +500,32 @@ token_kind_e lexer_c::ParseNumber(std::string &s)
     }
   }
 
+  s = data.substr(start, pos - start);
+
   return TOK_Number;
 }
 
-token_kind_e lexer_c::ParseString(std::string &s)
+token_kind_e lexer_c::ParseString(std::string_view &s)
 {
   // NOTE: we allow newlines ('\n') in the string, rather than produce an
   //       an unterminated-string error.
+  // NOTE: the contents are returned raw, escape sequences are skipped
+  //       over but not decoded, since no string value is ever used.
+
+  size_t start = ++pos;
+  size_t end = LEX_Find(data, pos, '"');
+
+  // the common case: no escapes, so the first quote ends the string
+  if (LEX_Find(data.substr(0, end), pos, '\\') == end)
+  {
+    line += static_cast<size_t>(std::count(data.begin() + static_cast<ptrdiff_t>(start),
+                                           data.begin() + static_cast<ptrdiff_t>(end), '\n'));
+    pos = std::min(end + 1, data.size());
+    s = data.substr(start, end - start);
+    return TOK_String;
+  }
 
-  pos++;
+  end = data.size();
 
   while (pos < data.size())
   {
@@ -295,13 +533,13 @@ token_kind_e lexer_c::ParseString(std::string &s)
 
     if (ch == '"')
     {
+      end = pos - 1;
       break;
     }
 
-    if (ch == DIR_SEP_CH)
+    if (ch == '\\' && pos < data.size())
     {
-      ParseEscape(s);
-      continue;
+      ch = static_cast<byte>(data[pos++]);
     }
 
     // bump line number at end of a line
@@ -309,124 +547,9 @@ token_kind_e lexer_c::ParseString(std::string &s)
     {
       line += 1;
     }
-
-    // skip all control characters except TAB and NEWLINE
-    if (ch < 32 && !(ch == '\t' || ch == '\n'))
-    {
-      continue;
-    }
-
-    if (ch == 127) // DEL
-    {
-      continue;
-    }
-
-    s.push_back(static_cast<char>(ch));
-  }
-
-  return TOK_String;
-}
-
-void lexer_c::ParseEscape(std::string &s)
-{
-  if (pos >= data.size())
-  {
-    s.push_back(DIR_SEP_CH);
-    return;
-  }
-
-  char ch = data[pos];
-
-  // avoid control chars, especially newline
-  if (ch < 32 || ch == 127)
-  {
-    s.push_back(DIR_SEP_CH);
-    return;
   }
 
-  pos++;
-
-  // octal sequence?  1 to 3 digits.
-  if ('0' <= ch && ch <= '7')
-  {
-    int val = static_cast<int32_t>(ch - '0');
-
-    ch = data[pos];
-    if ('0' <= ch && ch <= '7')
-    {
-      val = val * 8 + static_cast<int32_t>(ch - '0');
-      pos++;
-    }
+  s = data.substr(start, end - start);
 
-    ch = data[pos];
-    if ('0' <= ch && ch <= '7')
-    {
-      val = val * 8 + static_cast<int32_t>(ch - '0');
-      pos++;
-    }
-
-    s.push_back(static_cast<char>(val));
-    return;
-  }
-
-  // hexadecimal sequence?  followed by 1 to 2 hex digits.
-  if (ch == 'x' || ch == 'X')
-  {
-    char buffer[16];
-    char *p = buffer;
-
-    *p++ = '0';
-    *p++ = 'x';
-    *p++ = '0';
-
-    ch = data[pos];
-    if (std::isxdigit(ch))
-    {
-      *p++ = ch;
-      pos++;
-    }
-
-    ch = data[pos];
-    if (std::isxdigit(ch))
-    {
-      *p++ = ch;
-      pos++;
-    }
-
-    *p = 0;
-
-    long val = std::strtol(buffer, nullptr, 0);
-    s.push_back(static_cast<char>(val));
-    return;
-  }
-
-  switch (ch)
-  {
-  case 'a':
-    s.push_back('\a');
-    break; // bell
-  case 'b':
-    s.push_back('\b');
-    break; // backspace
-  case 'f':
-    s.push_back('\f');
-    break; // form feed
-  case 'n':
-    s.push_back('\n');
-    break; // newline
-  case 't':
-    s.push_back('\t');
-    break; // tab
-  case 'r':
-    s.push_back('\r');
-    break; // carriage return
-  case 'v':
-    s.push_back('\v');
-    break; // vertical tab
-
-  // the default is to reproduce the same character
-  default:
-    s.push_back(ch);
-    break;
-  }
+  return TOK_String;
 }
@@ -24,11 +24,207 @@
 #include "core.hpp"
 #include "local.hpp"
 
+#include <algorithm>
+
 static constexpr uint32_t POLY_BOX_SZ = 10;
 
+// most blocks per side of the polyobj line grid, larger maps get
+// larger blocks.
+static constexpr int32_t POLY_GRID_MAX = 256;
+static constexpr double POLY_BLOCK_MIN = 128.0;
+
+// lines near a polyobj spawn spot are found through a coarse grid of
+// blocks, each one listing the lines whose bounding box touches it, and
+// the lines of a sector through a sector to lines list.  Both are kept
+// flat: the lines of block (or sector) i are lines[start[i]] up to
+// lines[start[i + 1]], in increasing order.
+using polyobj_index_t = struct polyobj_index_s
+{
+  double origin_x = 0;
+  double origin_y = 0;
+  double block_size = POLY_BLOCK_MIN;
+  int32_t w = 1;
+  int32_t h = 1;
+
+  std::vector<uint32_t> block_start;
+  std::vector<uint32_t> block_lines;
+
+  std::vector<uint32_t> sector_start;
+  std::vector<uint32_t> sector_lines;
+
+  // lines gathered by FindPolyobjLines, in increasing order.
+  std::vector<uint32_t> found;
+};
+
+static int32_t PolyobjBlock(double v, double origin, double block_size, int32_t count)
+{
+  return std::clamp(static_cast<int32_t>(floor((v - origin) / block_size)), 0, count - 1);
+}
+
+// turn per-entry counts into start offsets, with a final total.
+static void PolyobjCountsToStarts(std::vector<uint32_t> &start)
+{
+  uint32_t total = 0;
+
+  for (uint32_t &entry : start)
+  {
+    uint32_t count = entry;
+    entry = total;
+    total += count;
+  }
+
+  start.push_back(total);
+}
+
+// call func(block) for every block touched by the bounding box of the
+// linedef.
+template <typename F>
+static void PolyobjWalkLine(const polyobj_index_t &index, const linedef_t *L, const F &func)
+{
+  int32_t bx1 = PolyobjBlock(std::min(L->start->x, L->end->x), index.origin_x, index.block_size, index.w);
+  int32_t by1 = PolyobjBlock(std::min(L->start->y, L->end->y), index.origin_y, index.block_size, index.h);
+  int32_t bx2 = PolyobjBlock(std::max(L->start->x, L->end->x), index.origin_x, index.block_size, index.w);
+  int32_t by2 = PolyobjBlock(std::max(L->start->y, L->end->y), index.origin_y, index.block_size, index.h);
+
+  for (int32_t by = by1; by <= by2; by++)
+  {
+    for (int32_t bx = bx1; bx <= bx2; bx++)
+    {
+      func(static_cast<size_t>(by) * static_cast<size_t>(index.w) + static_cast<size_t>(bx));
+    }
+  }
+}
+
+static void BuildPolyobjIndex(const level_t &level, polyobj_index_t &index)
+{
+  // only called when some polyobj line exists
+  double minx = level.linedefs[0]->start->x;
+  double miny = level.linedefs[0]->start->y;
+  double maxx = minx;
+  double maxy = miny;
+
+  for (size_t i = 0; i < level.linedefs.size(); i++)
+  {
+    const linedef_t *L = level.linedefs[i];
+
+    minx = std::min({minx, L->start->x, L->end->x});
+    miny = std::min({miny, L->start->y, L->end->y});
+    maxx = std::max({maxx, L->start->x, L->end->x});
+    maxy = std::max({maxy, L->start->y, L->end->y});
+  }
+
+  index.origin_x = floor(minx);
+  index.origin_y = floor(miny);
+  index.block_size = std::max(POLY_BLOCK_MIN, std::max(maxx - minx, maxy - miny) / POLY_GRID_MAX);
+  index.w = static_cast<int32_t>((maxx - index.origin_x) / index.block_size) + 1;
+  index.h = static_cast<int32_t>((maxy - index.origin_y) / index.block_size) + 1;
+
+  size_t block_count = static_cast<size_t>(index.w) * static_cast<size_t>(index.h);
+
+  index.block_start.assign(block_count, 0);
+  index.sector_start.assign(level.sectors.size(), 0);
+
+  // the sectors on the two sides of a line, just once when equal.
+  auto line_sectors = [](const linedef_t *L, const sector_t *&front, const sector_t *&back)
+  {
+    front = L->right ? L->right->sector : nullptr;
+    back = L->left ? L->left->sector : nullptr;
+
+    if (back == front)
+    {
+      back = nullptr;
+    }
+  };
+
+  // first pass counts, the second one fills in the lines
+  for (size_t pass = 0; pass < 2; pass++)
+  {
+    if (pass == 1)
+    {
+      PolyobjCountsToStarts(index.block_start);
+      PolyobjCountsToStarts(index.sector_start);
+
+      index.block_lines.resize(index.block_start.back());
+      index.sector_lines.resize(index.sector_start.back());
+    }
+
+    for (size_t i = 0; i < level.linedefs.size(); i++)
+    {
+      const linedef_t *L = level.linedefs[i];
+      auto line = static_cast<uint32_t>(i);
+
+      PolyobjWalkLine(index, L,
+                      [&index, pass, line](size_t block)
+                      {
+                        if (pass == 0)
+                        {
+                          index.block_start[block]++;
+                        }
+                        else
+                        {
+                          index.block_lines[index.block_start[block]++] = line;
+                        }
+                      });
+
+      const sector_t *sides[2];
+      line_sectors(L, sides[0], sides[1]);
+
+      for (const sector_t *sector : sides)
+      {
+        if (sector == nullptr)
+        {
+          continue;
+        }
+
+        if (pass == 0)
+        {
+          index.sector_start[sector->index]++;
+        }
+        else
+        {
+          index.sector_lines[index.sector_start[sector->index]++] = line;
+        }
+      }
+    }
+  }
+
+  // filling in moved every start up to the next one, move them back
+  std::copy_backward(index.block_start.begin(), index.block_start.end() - 1, index.block_start.end());
+  std::copy_backward(index.sector_start.begin(), index.sector_start.end() - 1, index.sector_start.end());
+
+  index.block_start[0] = 0;
+  index.sector_start[0] = 0;
+}
+
+// gather the lines from every block touching the given box into
+// index.found, each line once and in increasing order.
+static void FindPolyobjLines(polyobj_index_t &index, double x1, double y1, double x2, double y2)
+{
+  int32_t bx1 = PolyobjBlock(x1, index.origin_x, index.block_size, index.w);
+  int32_t by1 = PolyobjBlock(y1, index.origin_y, index.block_size, index.h);
+  int32_t bx2 = PolyobjBlock(x2, index.origin_x, index.block_size, index.w);
+  int32_t by2 = PolyobjBlock(y2, index.origin_y, index.block_size, index.h);
+
+  index.found.clear();
+
+  for (int32_t by = by1; by <= by2; by++)
+  {
+    for (int32_t bx = bx1; bx <= bx2; bx++)
+    {
+      size_t block = static_cast<size_t>(by) * static_cast<size_t>(index.w) + static_cast<size_t>(bx);
+
+      index.found.insert(index.found.end(), index.block_lines.begin() + index.block_start[block],
+                         index.block_lines.begin() + index.block_start[block + 1]);
+    }
+  }
+
+  std::sort(index.found.begin(), index.found.end());
+  index.found.erase(std::unique(index.found.begin(), index.found.end()), index.found.end());
+}
+
 /* ----- polyobj handling ----------------------------- */
 
-void MarkPolyobjSector(level_t &level, sector_t *sector)
+static void MarkPolyobjSector(level_t &level, const polyobj_index_t &index, sector_t *sector)
 {
   if (sector == nullptr)
   {
@@ -50,18 +246,13 @@ void MarkPolyobjSector(level_t &level, sector_t *sector)
   // the sector from being split.
   sector->has_polyobj = true;
 
-  for (size_t i = 0; i < level.linedefs.size(); i++)
+  for (uint32_t k = index.sector_start[sector->index]; k < index.sector_start[sector->index + 1]; k++)
   {
-    linedef_t *L = level.linedefs[i];
-
-    if ((L->right && L->right->sector == sector) || (L->left && L->left->sector == sector))
-    {
-      L->effects |= FX_DoNotSplitSeg;
-    }
+    level.linedefs[index.sector_lines[k]]->effects |= FX_DoNotSplitSeg;
   }
 }
 
-void MarkPolyobjPoint(level_t &level, double x, double y)
+static void MarkPolyobjPoint(level_t &level, polyobj_index_t &index, double x, double y)
 {
   size_t inside_count = 0;
 
@@ -78,9 +269,12 @@ void MarkPolyobjPoint(level_t &level, double x, double y)
   auto bmaxx = FloatToShort(x + POLY_BOX_SZ);
   auto bmaxy = FloatToShort(y + POLY_BOX_SZ);
 
-  for (size_t i = 0; i < level.linedefs.size(); i++)
+  // short coordinates are floored, so look one unit further out.
+  FindPolyobjLines(index, x - POLY_BOX_SZ - 1, y - POLY_BOX_SZ - 1, x + POLY_BOX_SZ + 1, y + POLY_BOX_SZ + 1);
+
+  for (uint32_t line : index.found)
   {
-    const linedef_t *L = level.linedefs[i];
+    const linedef_t *L = level.linedefs[line];
 
     if (CheckLinedefInsideBox(bminx, bminy, bmaxx, bmaxy, FloatToShort(L->start->x), FloatToShort(L->start->y),
                               FloatToShort(L->end->x), FloatToShort(L->end->y)))
@@ -92,12 +286,12 @@ void MarkPolyobjPoint(level_t &level, double x, double y)
 
       if (L->left)
       {
-        MarkPolyobjSector(level, L->left->sector);
+        MarkPolyobjSector(level, index, L->left->sector);
       }
 
       if (L->right)
       {
-        MarkPolyobjSector(level, L->right->sector);
+        MarkPolyobjSector(level, index, L->right->sector);
       }
 
       inside_count++;
@@ -115,9 +309,13 @@ void MarkPolyobjPoint(level_t &level, double x, double y)
   //       If the point is sitting directly on a (two-sided) line,
   //       then we mark the sectors on both sides.
 
-  for (size_t i = 0; i < level.linedefs.size(); i++)
+  // only the lines in the row of blocks holding the point can cross
+  // the horizontal line through it.
+  FindPolyobjLines(index, index.origin_x, y - DIST_EPSILON, index.origin_x + index.w * index.block_size, y + DIST_EPSILON);
+
+  for (uint32_t line : index.found)
   {
-    const linedef_t *L = level.linedefs[i];
+    const linedef_t *L = level.linedefs[line];
 
     double x1 = L->start->x;
     double y1 = L->start->y;
@@ -195,7 +393,7 @@ void MarkPolyobjPoint(level_t &level, double x, double y)
     return;
   }
 
-  MarkPolyobjSector(level, sector);
+  MarkPolyobjSector(level, index, sector);
 }
 
 //
@@ -228,6 +426,9 @@ void DetectPolyobjSectors(buildinfo_t &ctx, level_t &level)
               (ctx.polyobj.anchor == ZDoom_PolyObj_Anchor) ? "ZDOOM" : "HEXEN");
   }
 
+  polyobj_index_t index;
+  BuildPolyobjIndex(level, index);
+
   for (size_t j = 0; j < level.things.size(); j++)
   {
     thing_t *T = level.things[j];
@@ -247,6 +448,6 @@ void DetectPolyobjSectors(buildinfo_t &ctx, level_t &level)
       PrintLine(LOG_DEBUG, "[%s] Thing %zu at (%1.0f,%1.0f) is a polyobj spawner.", __func__, i, x, y);
     }
 
-    MarkPolyobjPoint(level, x, y);
+    MarkPolyobjPoint(level, index, x, y);
   }
 }
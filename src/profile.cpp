@@ -0,0 +1,538 @@
+//------------------------------------------------------------------------------
+//
+//  ELFBSP
+//
+//------------------------------------------------------------------------------
+//
+//  Copyright 2026 Guilherme Miranda
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------------
+
+#include <cstring>
+#include <deque>
+#include <format>
+#include <fstream>
+#include <mutex>
+
+#if defined(WIN32) || defined(_WIN32) || defined(_WIN64)
+  #define WIN32_LEAN_AND_MEAN
+  #define NOMINMAX
+  #include <windows.h>
+  #include <psapi.h>
+#else
+  #include <sys/resource.h>
+#endif
+
+#include "core.hpp"
+
+//------------------------------------------------------------------------
+// PROFILE : Hierarchical per-phase timings
+//------------------------------------------------------------------------
+
+static constexpr size_t PROFILE_ROOT = 0;
+
+using profile_node_t = struct profile_node_s
+{
+  const char *name;
+  size_t parent;
+  std::vector<size_t> children;
+
+  size_t calls = 0;
+  size_t recursion = 0; // re-entries folded into this node
+  double total_ms = 0;
+};
+
+using profile_tree_t = struct profile_tree_s
+{
+  std::vector<profile_node_t> nodes;
+  size_t current = PROFILE_ROOT;
+
+  profile_tree_s(void)
+  {
+    Reset();
+  }
+
+  void Reset(void)
+  {
+    nodes.clear();
+    nodes.push_back(profile_node_t{.name = "", .parent = PROFILE_ROOT, .children = {}});
+    current = PROFILE_ROOT;
+  }
+
+  size_t Child(size_t parent, const char *name)
+  {
+    for (size_t index : nodes[parent].children)
+    {
+      const char *other = nodes[index].name;
+
+      if (other == name || strcmp(other, name) == 0)
+      {
+        return index;
+      }
+    }
+
+    size_t index = nodes.size();
+    nodes.push_back(profile_node_t{.name = name, .parent = parent, .children = {}});
+    nodes[parent].children.push_back(index);
+
+    return index;
+  }
+};
+
+// the tree worker threads merge into, and the JSON built so far
+static std::mutex profile_lock;
+static profile_tree_t profile_total;
+static std::string profile_json;
+
+static void MergeProfileNode(profile_tree_t &dest, size_t dest_index, const profile_tree_t &src, size_t src_index)
+{
+  const profile_node_t &from = src.nodes[src_index];
+
+  dest.nodes[dest_index].calls += from.calls;
+  dest.nodes[dest_index].total_ms += from.total_ms;
+
+  for (size_t child : from.children)
+  {
+    MergeProfileNode(dest, dest.Child(dest_index, src.nodes[child].name), src, child);
+  }
+}
+
+// worker threads hand their timings over when they exit
+using profile_thread_t = struct profile_thread_s
+{
+  profile_tree_t tree;
+
+  ~profile_thread_s(void)
+  {
+    std::lock_guard<std::mutex> guard(profile_lock);
+    MergeProfileNode(profile_total, PROFILE_ROOT, tree, PROFILE_ROOT);
+  }
+};
+
+static thread_local profile_thread_t profile_thread;
+
+// the high-water mark of the whole process, it never goes down
+static size_t PeakResidentBytes(void)
+{
+#if defined(WIN32) || defined(_WIN32) || defined(_WIN64)
+  PROCESS_MEMORY_COUNTERS counters;
+
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+  {
+    return 0;
+  }
+
+  return static_cast<size_t>(counters.PeakWorkingSetSize);
+#else
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+  {
+    return 0;
+  }
+
+  // Linux reports kilobytes, MacOS reports bytes
+  return static_cast<size_t>(usage.ru_maxrss) * (MACOS ? 1 : 1024);
+#endif
+}
+
+void ProfileEnter(const char *name)
+{
+  profile_tree_t &tree = profile_thread.tree;
+  profile_node_t &cur = tree.nodes[tree.current];
+
+  // recursive calls are folded into the outermost scope
+  if (tree.current != PROFILE_ROOT && (cur.name == name || strcmp(cur.name, name) == 0))
+  {
+    cur.calls++;
+    cur.recursion++;
+    return;
+  }
+
+  tree.current = tree.Child(tree.current, name);
+  tree.nodes[tree.current].calls++;
+}
+
+void ProfileLeave(profile_clock_t::time_point start, profile_clock_t::time_point end)
+{
+  profile_tree_t &tree = profile_thread.tree;
+  profile_node_t &cur = tree.nodes[tree.current];
+
+  if (cur.recursion > 0)
+  {
+    cur.recursion--;
+    return;
+  }
+
+  double elapsed_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+  cur.total_ms += elapsed_ms;
+
+  if (config.trace)
+  {
+    TraceSpan(cur.name, start, end);
+  }
+
+  tree.current = cur.parent;
+}
+
+profile_path_t ProfileCurrentPath(void)
+{
+  const profile_tree_t &tree = profile_thread.tree;
+  profile_path_t path;
+
+  for (size_t index = tree.current; index != PROFILE_ROOT; index = tree.nodes[index].parent)
+  {
+    path.push_back(tree.nodes[index].name);
+  }
+
+  std::reverse(path.begin(), path.end());
+
+  return path;
+}
+
+void ProfileAttachPath(const profile_path_t &path)
+{
+  profile_tree_t &tree = profile_thread.tree;
+
+  // only sets the position, the caller already counts these scopes
+  for (const char *name : path)
+  {
+    tree.current = tree.Child(tree.current, name);
+  }
+}
+
+// self time can't go negative when children ran on worker threads
+static double ProfileSelfTime(const profile_tree_t &tree, const profile_node_t &node)
+{
+  double child_ms = 0;
+
+  for (size_t child : node.children)
+  {
+    child_ms += tree.nodes[child].total_ms;
+  }
+
+  return std::max(node.total_ms - child_ms, 0.0);
+}
+
+static void PrintProfileNode(const profile_tree_t &tree, size_t index, size_t depth)
+{
+  const profile_node_t &node = tree.nodes[index];
+
+  int indent = static_cast<int>(depth * 2);
+  int width = std::max(36 - indent, 1);
+
+  PrintLine(LOG_NORMAL, "  %*s%-*s %9zu %11.2f %11.2f", indent, "", width, node.name, node.calls, node.total_ms,
+            ProfileSelfTime(tree, node));
+
+  for (size_t child : node.children)
+  {
+    PrintProfileNode(tree, child, depth + 1);
+  }
+}
+
+static std::string JsonEscape(const char *str)
+{
+  std::string out;
+
+  for (const char *p = str; *p; p++)
+  {
+    if (*p == '"' || *p == '\\')
+    {
+      out += '\\';
+    }
+
+    out += *p;
+  }
+
+  return out;
+}
+
+static void JsonProfileNode(std::string &out, const profile_tree_t &tree, size_t index)
+{
+  const profile_node_t &node = tree.nodes[index];
+
+  out += std::format(R"({{"name":"{}","calls":{},"total_ms":{:.3f},"self_ms":{:.3f},"children":[)",
+                     JsonEscape(node.name), node.calls, node.total_ms, ProfileSelfTime(tree, node));
+
+  for (size_t i = 0; i < node.children.size(); i++)
+  {
+    if (i > 0)
+    {
+      out += ',';
+    }
+
+    JsonProfileNode(out, tree, node.children[i]);
+  }
+
+  out += "]}";
+}
+
+void ProfileReport(const char *level_name, const char *filename)
+{
+  std::lock_guard<std::mutex> guard(profile_lock);
+
+  // the calling thread goes first, so phases keep their order of entry
+  profile_tree_t tree;
+
+  MergeProfileNode(tree, PROFILE_ROOT, profile_thread.tree, PROFILE_ROOT);
+  MergeProfileNode(tree, PROFILE_ROOT, profile_total, PROFILE_ROOT);
+
+  profile_thread.tree.Reset();
+  profile_total.Reset();
+
+  // not per phase, worker threads and earlier levels share it
+  size_t peak = PeakResidentBytes();
+  std::string peak_mb = (peak > 0) ? std::format("{:.1f} MB", static_cast<double>(peak) / (1024.0 * 1024.0)) : "unknown";
+
+  PrintLine(LOG_NORMAL, "[%s] %s (process peak memory: %s)", __func__, level_name, peak_mb.c_str());
+  PrintLine(LOG_NORMAL, "  %-36s %9s %11s %11s", "phase", "calls", "total ms", "self ms");
+
+  for (size_t child : tree.nodes[PROFILE_ROOT].children)
+  {
+    PrintProfileNode(tree, child, 0);
+  }
+
+  profile_json += profile_json.empty() ? "[\n" : ",\n";
+  profile_json += std::format(R"({{"file":"{}","level":"{}","process_peak_rss":{},"phases":[)",
+                              JsonEscape(filename), JsonEscape(level_name), peak);
+
+  for (size_t i = 0; i < tree.nodes[PROFILE_ROOT].children.size(); i++)
+  {
+    if (i > 0)
+    {
+      profile_json += ',';
+    }
+
+    JsonProfileNode(profile_json, tree, tree.nodes[PROFILE_ROOT].children[i]);
+  }
+
+  profile_json += "]}";
+}
+
+void WriteProfileJson(const char *filename)
+{
+  auto file = std::ofstream(filename);
+
+  if (!file.is_open())
+  {
+    PrintLine(LOG_WARN, "[%s] Couldn't open file %s for writing.", __func__, filename);
+    return;
+  }
+
+  file << (profile_json.empty() ? "[" : profile_json) << "\n]\n";
+  file.close();
+
+  PrintLine(LOG_NORMAL, "[%s] Successfully wrote profile to JSON file %s.", __func__, filename);
+}
+
+//------------------------------------------------------------------------
+// TRACE : Chrome trace-event timeline
+//------------------------------------------------------------------------
+
+// spans shorter than this are dropped, EvalPartition alone would
+// otherwise add millions of them
+static constexpr int64_t TRACE_MIN_US = 20;
+
+// spans per thread buffer, before it gets handed over
+static constexpr size_t TRACE_BUFFER_SIZE = 4096;
+
+using trace_event_t = struct trace_event_s
+{
+  const char *name;
+  const char *arg_name;
+  int64_t arg;
+  int64_t start_us;
+  int64_t duration_us;
+  uint32_t thread_id;
+};
+
+static std::mutex trace_lock;
+static std::string trace_filename;
+static profile_clock_t::time_point trace_epoch;
+static std::vector<std::vector<trace_event_t>> trace_buffers;
+static std::deque<std::string> trace_names;
+static std::atomic<uint32_t> trace_next_thread = 1;
+
+using trace_thread_t = struct trace_thread_s;
+
+// null once the main thread's buffer is gone
+static trace_thread_t *trace_main_thread = nullptr;
+
+struct trace_thread_s
+{
+  uint32_t id = trace_next_thread++;
+  std::vector<trace_event_t> events;
+
+  // the caller holds trace_lock
+  void HandOver(void)
+  {
+    if (events.empty())
+    {
+      return;
+    }
+
+    trace_buffers.push_back(std::move(events));
+
+    events.clear();
+  }
+
+  void Flush(void)
+  {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    HandOver();
+  }
+
+  ~trace_thread_s(void)
+  {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    HandOver();
+
+    if (trace_main_thread == this)
+    {
+      trace_main_thread = nullptr;
+    }
+  }
+};
+
+static thread_local trace_thread_t trace_thread;
+
+void TraceSpan(const char *name, profile_clock_t::time_point start, profile_clock_t::time_point end, const char *arg_name,
+               int64_t arg)
+{
+  int64_t start_us = std::chrono::duration_cast<std::chrono::microseconds>(start - trace_epoch).count();
+  int64_t duration_us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+  if (duration_us < TRACE_MIN_US)
+  {
+    return;
+  }
+
+  trace_thread_t &thread = trace_thread;
+
+  if (thread.events.capacity() == 0)
+  {
+    thread.events.reserve(TRACE_BUFFER_SIZE);
+  }
+
+  thread.events.push_back(trace_event_t{name, arg_name, arg, start_us, duration_us, thread.id});
+
+  if (thread.events.size() >= TRACE_BUFFER_SIZE)
+  {
+    thread.Flush();
+  }
+}
+
+//
+// Returns a copy of 'name' which lives until the trace is written,
+// for names which come from data that is freed earlier (level names).
+//
+const char *TraceName(const char *name)
+{
+  if (!config.trace)
+  {
+    return name;
+  }
+
+  std::lock_guard<std::mutex> guard(trace_lock);
+  trace_names.emplace_back(name);
+
+  return trace_names.back().c_str();
+}
+
+//
+// Runs at exit, on whichever thread called it. That thread's buffer is
+// already flushed, but a fatal error on a worker thread leaves the main
+// thread's buffer behind, so it is taken here.
+//
+static void WriteTrace(void)
+{
+  std::lock_guard<std::mutex> guard(trace_lock);
+
+  if (trace_main_thread != nullptr)
+  {
+    trace_main_thread->HandOver();
+  }
+
+  auto file = std::ofstream(trace_filename);
+
+  if (!file.is_open())
+  {
+    PrintLine(LOG_WARN, "[%s] Couldn't open file %s for writing.", __func__, trace_filename.c_str());
+    return;
+  }
+
+  uint32_t num_threads = trace_next_thread.load();
+
+  file << R"({"displayTimeUnit":"ms","traceEvents":[)" << '\n';
+
+  for (uint32_t id = 1; id < num_threads; id++)
+  {
+    file << std::format(R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"{}"}}}},)", id,
+                        (id == 1) ? "main" : "worker")
+         << '\n';
+  }
+
+  bool first = true;
+
+  for (const auto &buffer : trace_buffers)
+  {
+    for (const auto &event : buffer)
+    {
+      if (!first)
+      {
+        file << ",\n";
+      }
+      first = false;
+
+      file << std::format(R"({{"name":"{}","ph":"X","pid":1,"tid":{},"ts":{},"dur":{})", JsonEscape(event.name),
+                          event.thread_id, event.start_us, event.duration_us);
+
+      if (event.arg_name != nullptr)
+      {
+        file << std::format(R"(,"args":{{"{}":{}}})", event.arg_name, event.arg);
+      }
+
+      file << '}';
+    }
+  }
+
+  // keeps the metadata list valid when no span was recorded
+  if (first)
+  {
+    file << R"({"name":"process_name","ph":"M","pid":1,"args":{"name":"ELFBSP"}})";
+  }
+
+  file << "\n]}\n";
+  file.close();
+
+  trace_names.clear();
+  trace_buffers.clear();
+
+  PrintLine(LOG_NORMAL, "[%s] Successfully wrote trace to JSON file %s.", __func__, trace_filename.c_str());
+}
+
+void TraceStart(const char *filename)
+{
+  trace_filename = filename;
+  trace_epoch = profile_clock_t::now();
+
+  // make sure the main thread is thread #1
+  trace_thread.events.reserve(TRACE_BUFFER_SIZE);
+  trace_main_thread = &trace_thread;
+
+  config.trace = true;
+
+  // also covers fatal errors, which exit straight away
+  std::atexit(WriteTrace);
+}
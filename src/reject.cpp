@@ -169,7 +169,7 @@ static void Reject_DebugGroups(level_t &level)
 
 static void Reject_WriteLump(level_t &level)
 {
-  Lump_c *lump = CreateLevelLump(level, "REJECT", level.reject_size);
+  Lump_c *lump = CreateLevelLump(level, "REJECT");
   lump->Write(level.reject_matrix, level.reject_size);
   lump->Finish();
 }
@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <vector>
 
 //------------------------------------------------------------------------
 //  LUMP Handling
@@ -69,6 +70,203 @@ void Lump_c::MakeEntry(raw_wad_entry_t *entry)
   entry->size = GetLittleEndian(IndexToInt(l_length));
 }
 
+//
+// Zlib compression support
+//
+
+// lumps larger than one block are compressed a block at a time, across
+// all cores.  The blocks do not depend on the number of threads, so the
+// output is always the same.
+static constexpr size_t ZLIB_BLOCK_SIZE = 128 * 1024;
+
+// each block is primed with the end of the block before it, so nothing
+// is lost compared to a single stream.
+static constexpr size_t ZLIB_WINDOW_SIZE = 32 * 1024;
+
+static constexpr int32_t ZLIB_WINDOW_BITS = 15;
+static constexpr int32_t ZLIB_MEM_LEVEL = 8;
+
+// compress a whole lump as one ordinary zlib stream.
+static void DeflateWhole(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+{
+  zng_stream zs = {};
+
+  if (Z_OK != zng_deflateInit(&zs, config.compress_level))
+  {
+    PrintLine(LOG_ERROR, "ERROR: Trouble starting Zlib compression.");
+  }
+
+  out.resize(zng_deflateBound(&zs, size));
+
+  zs.next_in = data;
+  zs.avail_in = static_cast<uint32_t>(size);
+  zs.next_out = out.data();
+  zs.avail_out = static_cast<uint32_t>(out.size());
+
+  if (Z_STREAM_END != zng_deflate(&zs, Z_FINISH))
+  {
+    PrintLine(LOG_ERROR, "ERROR: Trouble Zlib compressing %zu bytes.", size);
+  }
+
+  out.resize(out.size() - zs.avail_out);
+
+  zng_deflateEnd(&zs);
+}
+
+// compress one block as raw deflate data.  Every block but the last one
+// ends on a byte boundary, so the blocks can simply be joined together.
+static void DeflateBlock(const uint8_t *data, size_t size, size_t start, size_t end, std::vector<uint8_t> &out)
+{
+  zng_stream zs = {};
+  bool last = (end == size);
+
+  if (Z_OK != zng_deflateInit2(&zs, config.compress_level, Z_DEFLATED, -ZLIB_WINDOW_BITS, ZLIB_MEM_LEVEL, Z_DEFAULT_STRATEGY))
+  {
+    PrintLine(LOG_ERROR, "ERROR: Trouble starting Zlib compression.");
+  }
+
+  if (start > 0)
+  {
+    size_t dict = std::min(start, ZLIB_WINDOW_SIZE);
+    zng_deflateSetDictionary(&zs, data + start - dict, static_cast<uint32_t>(dict));
+  }
+
+  // a sync flush adds an empty stored block, leave room for it
+  out.resize(zng_deflateBound(&zs, end - start) + 16);
+
+  zs.next_in = data + start;
+  zs.avail_in = static_cast<uint32_t>(end - start);
+  zs.next_out = out.data();
+  zs.avail_out = static_cast<uint32_t>(out.size());
+
+  int32_t err = zng_deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+
+  if ((last && err != Z_STREAM_END) || (!last && (err != Z_OK || zs.avail_in > 0 || zs.avail_out == 0)))
+  {
+    PrintLine(LOG_ERROR, "ERROR: Trouble Zlib compressing %zu bytes.", end - start);
+  }
+
+  out.resize(out.size() - zs.avail_out);
+
+  zng_deflateEnd(&zs);
+}
+
+// compress a large lump in blocks, giving a single zlib stream like the
+// one from pigz: the usual header, the deflate blocks one after another,
+// then the checksum of the whole data.
+static void DeflateBlocks(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+{
+  size_t count = (size + ZLIB_BLOCK_SIZE - 1) / ZLIB_BLOCK_SIZE;
+
+  std::vector<std::vector<uint8_t>> blocks(count);
+
+  ParallelFor(count,
+              [data, size, &blocks](size_t i)
+              {
+                size_t start = i * ZLIB_BLOCK_SIZE;
+                size_t end = std::min(start + ZLIB_BLOCK_SIZE, size);
+
+                DeflateBlock(data, size, start, end, blocks[i]);
+              });
+
+  // header: deflate with a 32K window, plus the level hint
+  int32_t level_flags = 3;
+
+  if (config.compress_level < 2)
+  {
+    level_flags = 0;
+  }
+  else if (config.compress_level < 6)
+  {
+    level_flags = 1;
+  }
+  else if (config.compress_level == 6)
+  {
+    level_flags = 2;
+  }
+
+  uint32_t header = (0x78u << 8) | static_cast<uint32_t>(level_flags << 6);
+  header += 31 - (header % 31);
+
+  uint32_t adler = static_cast<uint32_t>(zng_adler32(1, nullptr, 0));
+
+  for (size_t start = 0; start < size; start += ZLIB_BLOCK_SIZE)
+  {
+    size_t len = std::min(ZLIB_BLOCK_SIZE, size - start);
+    adler = static_cast<uint32_t>(zng_adler32(adler, data + start, static_cast<uint32_t>(len)));
+  }
+
+  out.clear();
+  out.push_back(static_cast<uint8_t>(header >> 8));
+  out.push_back(static_cast<uint8_t>(header & 0xFF));
+
+  for (const auto &block : blocks)
+  {
+    out.insert(out.end(), block.begin(), block.end());
+  }
+
+  for (int32_t shift = 24; shift >= 0; shift -= 8)
+  {
+    out.push_back(static_cast<uint8_t>(adler >> shift));
+  }
+}
+
+void Lump_c::Finish_Zlib(void)
+{
+  auto mark = Benchmarker(__func__);
+
+  SYS_ASSERT(zlib_init);
+
+  zlib_init = false;
+
+  const uint8_t *data = out_data.data() + zlib_start;
+  size_t size = out_data.size() - zlib_start;
+
+  std::vector<uint8_t> out;
+
+  if (size > ZLIB_BLOCK_SIZE)
+  {
+    DeflateBlocks(data, size, out);
+  }
+  else
+  {
+    DeflateWhole(data, size, out);
+  }
+
+  out_data.resize(zlib_start);
+  out_data.insert(out_data.end(), out.begin(), out.end());
+}
+
+void Lump_c::Finish(void)
+{
+  SYS_ASSERT(!zlib_init);
+
+  size_t length = out_data.size();
+
+  if (length == 0)
+  {
+    l_start = 0;
+    l_length = 0;
+    return;
+  }
+
+  // the lump is not counted while looking for space, so a lump that
+  // is rewritten can reuse its old place when it still fits.
+  l_start = parent->PositionForWrite(length);
+
+  if (fwrite(out_data.data(), length, 1, parent->fp) != 1)
+  {
+    PrintLine(LOG_ERROR, "ERROR: Failure writing %s lump.", Name());
+  }
+
+  l_length = length;
+
+  parent->FinishLump();
+
+  // release the memory
+  std::vector<uint8_t>().swap(out_data);
+}
+
 //------------------------------------------------------------------------
 //  WAD Reading Interface
 //------------------------------------------------------------------------
@@ -708,6 +906,8 @@ void Wad_file::BeginWrite(void)
 
 void Wad_file::EndWrite(void)
 {
+  auto mark = Benchmarker("WriteDirectory");
+
   if (!begun_write)
   {
     PrintLine(LOG_ERROR, "ERROR: Wad_file::EndWrite() called without BeginWrite()");
@@ -751,15 +951,11 @@ void Wad_file::FixGroup(std::vector<size_t> &group, size_t index, size_t num_add
   }
 }
 
-Lump_c *Wad_file::AddLump(const char *name, size_t max_size)
+Lump_c *Wad_file::AddLump(const char *name)
 {
   SYS_ASSERT(begun_write);
 
-  begun_max_size = max_size;
-
-  size_t start = PositionForWrite(max_size);
-
-  Lump_c *lump = MakeLump(this, name, start, 0);
+  Lump_c *lump = MakeLump(this, name, 0, 0);
 
   // check if the insert_point is still valid
   if (insert_point >= NumLumps())
@@ -788,16 +984,13 @@ Lump_c *Wad_file::AddLump(const char *name, size_t max_size)
   return lump;
 }
 
-void Wad_file::RecreateLump(Lump_c *lump, size_t max_size)
+void Wad_file::RecreateLump(Lump_c *lump)
 {
   SYS_ASSERT(begun_write);
 
-  begun_max_size = max_size;
-
-  size_t start = PositionForWrite(max_size);
-
-  lump->l_start = start;
+  lump->l_start = 0;
   lump->l_length = 0;
+  lump->out_data.clear();
 }
 
 void Wad_file::InsertPoint(size_t index)
@@ -889,9 +1082,9 @@ size_t Wad_file::FindFreeSpace(size_t length)
   return offset;
 }
 
-size_t Wad_file::PositionForWrite(size_t max_size)
+size_t Wad_file::PositionForWrite(size_t length)
 {
-  int64_t want_pos = static_cast<int64_t>(max_size == NO_INDEX ? HighWaterMark() : FindFreeSpace(max_size));
+  int64_t want_pos = static_cast<int64_t>(length == NO_INDEX ? HighWaterMark() : FindFreeSpace(length));
 
   // determine if position is past end of file
   // (difference should only be a few bytes)
@@ -939,16 +1132,8 @@ size_t Wad_file::PositionForWrite(size_t max_size)
   return static_cast<size_t>(want_pos);
 }
 
-void Wad_file::FinishLump(size_t final_size)
+void Wad_file::FinishLump(void)
 {
-  fflush(fp);
-
-  // sanity check
-  if (final_size > begun_max_size)
-  {
-    PrintLine(LOG_ERROR, "ERROR: wrote too much in lump (%zu > %zu)", final_size, begun_max_size);
-  }
-
   int64_t pos = ftell(fp);
 
   if (pos & 3)